@@ -333,8 +333,7 @@ std::string Disass::disass_arm_hds_data_transfer(uint32_t opcode)
             }
         }
     }
-    puts("disass_arm_hds_data_transfer fell through!?");
-    exit(1);
+    throw Emu_error("disass_arm_hds_data_transfer fell through!?");
 }
 
 // get a shift type diassembeld from an opcode
@@ -593,8 +592,7 @@ std::string Disass::disass_arm_data_processing(uint32_t opcode)
 
         default:
         {
-            printf("unknown data processing diass %08x\n",op);
-            exit(1);
+            throw Emu_error(fmt::format("unknown data processing diass {:08x}",op));
         }
     }
 }
@@ -689,7 +687,5 @@ std::string Disass::disass_arm_single_data_transfer(uint32_t opcode)
 std::string Disass::disass_arm_unknown(uint32_t opcode)
 {
     uint32_t op = ((opcode >> 4) & 0xf) | ((opcode >> 16) & 0xff0);
-    printf("[disass-arm]%08x:unknown opcode %08x:%08x\n",pc,opcode,op);
-    cpu->print_regs();
-    exit(1);   
+    throw Emu_error(fmt::format("[disass-arm]{:08x}:unknown opcode {:08x}:{:08x}",pc,opcode,op));
 }
\ No newline at end of file
@@ -12,19 +12,6 @@ void Cpu::arm_fill_pipeline() // need to verify this...
     regs[PC] += ARM_WORD_SIZE;
 }
 
-// fetch opcodes and handle the 3 stage
-// pipeline
-uint32_t Cpu::fetch_arm_opcode()
-{
-
-    // ignore the pipeline for now
-    regs[PC] &= ~3; // algin
-
-    uint32_t opcode = mem->read_memt<uint32_t>(regs[PC]);
-    regs[PC] += ARM_WORD_SIZE;
-    return opcode;
-}
-
 void Cpu::execute_arm_opcode(uint32_t instr)
 {
     // get the bits that determine the kind of instr it is
@@ -43,27 +30,177 @@ void Cpu::exec_arm()
         debug->enter_debugger();
     }
 #endif
-    uint32_t instr = fetch_arm_opcode();
+    // ignore the pipeline for now
+    regs[PC] &= ~3; // algin
+
+    const Arm_block_instr instr = fetch_arm_opcode();
 
     // if the condition is not met just
     // advance past the instr
-    if(!cond_met((instr >> 28) & 0xf))
+    // (most instrs are AL so skip the check for them)
+    const int cond = (instr.opcode >> 28) & 0xf;
+    if(cond != AL && !cond_met(cond))
     {
        return;
     }
 
-    execute_arm_opcode(instr);
+    // handler is allready decoded
+    std::invoke(instr.handler,this,instr.opcode);
 }
 
 
 
 
+// work out the handler for a set of decode bits
+// (bits 27-20 and 7-4 of the opcode)
+// the hot handlers get the fields they switch on as template params
+template<const int i>
+constexpr Cpu::ARM_OPCODE_FPTR Cpu::get_arm_handler()
+{
+    switch(i >> 10) // bits 27 and 26 of opcode
+    {
+        case 0b00:
+        {
+            constexpr int op = (i >> 5) & 0xf;
+
+            //  ARM.7: Multiply and Multiply-Accumulate (MUL,MLA)
+            if constexpr(((i & 0b1111) == 0b1001) && ((i >> 7) & 0b111111) == 0b000000) 
+            {
+                return &Cpu::arm_mul;
+            }
+
+            //  multiply and accumulate long
+            else if constexpr(((i & 0b1111) == 0b1001) && ((i >> 7) & 0b111111) == 0b000001) 
+            {
+                return &Cpu::arm_mull;
+            }
+
+
+            // Single Data Swap (SWP)  
+            else if constexpr(((i & 0b1111) == 0b1001) && ((i >> 7) & 0b11111) == 0b00010 && ((i >> 4) & 0b11) == 0b00)
+            {
+                return &Cpu::arm_swap;
+            }
+
+
+
+            // ARM.10: Halfword, Doubleword, and Signed Data Transfer
+            // (may require more stringent checks than this)
+            // think this might cause conflicts?
+            else if constexpr(((i >> 9) & 0b111) == 0b000 && is_set(i,3) && is_set(i,0))
+            {
+                return &Cpu::arm_hds_data_transfer<is_set(i,8),is_set(i,7),is_set(i,6),
+                    is_set(i,5),is_set(i,4),(i >> 1) & 0x3>;
+            }
+
+
+            //ARM.3: Branch and Exchange
+            // bx
+            else if constexpr(i == 0b000100100001)
+            {
+                return &Cpu::arm_branch_and_exchange;
+            }
+
+
+            // msr and mrs
+            // ARM.6: PSR Transfer
+            // bit 24-23 must be 10 for this instr
+            // bit 20 must also be zero
+            
+            // check it ocupies the unused space for
+            //TST,TEQ,CMP,CMN with a S of zero
+            else if constexpr(op >= 0x8 && op <= 0xb && !is_set(i,4))
+            {
+                return &Cpu::arm_psr;
+            }
+
+            //  ARM.5: Data Processing 00 at bit 27
+            // shift fields are meaningless for an immediate operand
+            else if constexpr(is_set(i,9))
+            {
+                return &Cpu::arm_data_processing<true,op,is_set(i,4),0,false>;
+            }
+
+            else
+            { 
+                return &Cpu::arm_data_processing<false,op,is_set(i,4),(i >> 1) & 0x3,is_set(i,0)>;
+            }
+        }
+
+        //ARM.9: Single Data Transfer
+        case 0b01:
+        {
+            return &Cpu::arm_single_data_transfer<is_set(i,9),is_set(i,8),
+                is_set(i,7),is_set(i,6),is_set(i,5),is_set(i,4)>;
+        }
+
+        case 0b10:
+        {
+            // 101 (ARM.4: Branch and Branch with Link)
+            if constexpr(is_set(i,9))
+            {
+                return &Cpu::arm_branch<is_set(i,8)>;
+            }
+
+            // 100
+            // ARM.11: Block Data Transfer (LDM,STM)
+            else
+            {
+                return &Cpu::arm_block_data_transfer<is_set(i,8),is_set(i,7),
+                    is_set(i,6),is_set(i,5),is_set(i,4)>;
+            }
+        }
+
+        case 0b11:
+        {
+            // 1111 ARM.13: Software Interrupt
+            if constexpr(((i >> 8) & 0b11) == 0b11)
+            {
+                return &Cpu::arm_swi;
+            }
+
+            // coprocessor instrs (none on the gba)
+            else
+            {
+                return &Cpu::arm_unknown;
+            }
+        }
+
+        default:
+        {
+            return &Cpu::arm_unknown;
+        }
+    }
+}
+
+template<size_t... I>
+constexpr std::array<Cpu::ARM_OPCODE_FPTR,sizeof...(I)> Cpu::gen_arm_opcode_table(std::index_sequence<I...>)
+{
+    return {get_arm_handler<I>()...};
+}
+
+void Cpu::init_arm_opcode_table()
+{
+    constexpr auto table = gen_arm_opcode_table(std::make_index_sequence<4096>{});
+    arm_opcode_table.assign(table.begin(),table.end());
+}
+
+
 void Cpu::arm_unknown(uint32_t opcode)
 {
     uint32_t op = ((opcode >> 4) & 0xf) | ((opcode >> 16) & 0xff0);
-    printf("[cpu-arm %08x]unknown opcode %08x:%08x\n",regs[PC],opcode,op);
-    print_regs();
-    exit(1);
+    throw Emu_error(fmt::format("[cpu-arm {:08x}]unknown opcode {:08x}:{:08x}",regs[PC],opcode,op));
+}
+
+void Cpu::arm_swi(uint32_t opcode)
+{
+    // bios only looks at the top byte of the comment field
+    if(hle_swi((opcode >> 16) & 0xff,regs[PC] - ARM_WORD_SIZE))
+    {
+        return;
+    }
+
+    enter_swi();
 }
 
 // add timings
@@ -157,7 +294,7 @@ void Cpu::arm_mul(uint32_t opcode)
         set_nz_flag(regs[rd]);
 
         // c destroyed
-        cpsr = deset_bit(cpsr,C_BIT);
+        set_carry_flag(false);
     }
 
     cycle_tick(1);
@@ -197,13 +334,14 @@ void Cpu::arm_swap(uint32_t opcode)
 }
 
 // <--- double check this code as its the most likely error source
+template<const bool P, const bool U, const bool S, const bool W, const bool L>
 void Cpu::arm_block_data_transfer(uint32_t opcode)
 {
-    bool p = is_set(opcode,24);
-    bool u = is_set(opcode,23);
-    bool s = is_set(opcode,22); // psr or force user mode
-    bool w = is_set(opcode,21);
-    bool l = is_set(opcode,20);
+    bool p = P;
+    constexpr bool u = U;
+    constexpr bool s = S; // psr or force user mode
+    bool w = W;
+    constexpr bool l = L;
     int rn = (opcode >> 16) & 0xf;
     int rlist = opcode & 0xffff;
 
@@ -292,9 +430,7 @@ void Cpu::arm_block_data_transfer(uint32_t opcode)
 
                 else
                 {
-                    printf("[block data: %08x] illegal status bank %x\n",regs[PC],cpu_mode);
-                    print_regs();
-                    exit(1);
+                    throw Emu_error(fmt::format("[block data: {:08x}] illegal status bank {:x}",regs[PC],static_cast<int>(cpu_mode)));
                 }
             }
         }
@@ -360,6 +496,7 @@ void Cpu::arm_block_data_transfer(uint32_t opcode)
 
 // need to handle instr variants and timings on these
 
+template<const bool L>
 void Cpu::arm_branch(uint32_t opcode)
 {
     // account for prefetch operation
@@ -371,7 +508,7 @@ void Cpu::arm_branch(uint32_t opcode)
     offset = sign_extend(offset,26);
 
     // if the link bit is set this acts as a call instr
-    if(is_set(opcode,24))
+    if(L)
     {
         // bits 0:1  are allways cleared
         regs[LR] = (regs[PC] & ~3);
@@ -380,6 +517,11 @@ void Cpu::arm_branch(uint32_t opcode)
 
     regs[PC] = pc + offset;
     cycle_tick(3); //2s + 1n cycles
+
+    if(!L)
+    {
+        check_idle_loop(pc - (ARM_WORD_SIZE * 2));
+    }
 }
 
 // psr transfer
@@ -433,6 +575,7 @@ void Cpu::arm_psr(uint32_t opcode)
         // and then the value ored
         if(!spsr) // cpsr
         {
+            calc_flags();
             set_cpsr((cpsr & ~mask) | v);
         }
 
@@ -445,9 +588,7 @@ void Cpu::arm_psr(uint32_t opcode)
 
             else
             {
-                printf("[msr: %08x]Illegal spsr write %x\n",regs[PC],cpu_mode);
-                print_regs();
-                exit(1);
+                throw Emu_error(fmt::format("[msr: {:08x}]Illegal spsr write {:x}",regs[PC],static_cast<int>(cpu_mode)));
             }
         }
     }
@@ -466,14 +607,13 @@ void Cpu::arm_psr(uint32_t opcode)
 
             else 
             {
-                printf("[mrs: %08x]Illegal spsr read %x\n",regs[PC],cpu_mode);
-                print_regs();
-                exit(1);
+                throw Emu_error(fmt::format("[mrs: {:08x}]Illegal spsr read {:x}",regs[PC],static_cast<int>(cpu_mode)));
             }
         }
 
         else
         {
+            calc_flags();
             regs[rd] = cpsr;
         }
 
@@ -515,6 +655,7 @@ b) set them appropiately...
 
 */
 
+template<const bool IMM, const int OP, const bool S, const int SHIFT_TYPE, const bool REG_SHIFT>
 void Cpu::arm_data_processing(uint32_t opcode)
 {
 
@@ -536,17 +677,17 @@ void Cpu::arm_data_processing(uint32_t opcode)
     }
 
     // if s bit is set update flags
-    bool update_flags = is_set(opcode,20);
+    const bool update_flags = S;
 
     // default to preserve the carry
     // incase of a zero shift
-    bool shift_carry = is_set(cpsr,C_BIT);
+    bool shift_carry = get_carry_flag();
 
 
 
 
     // ror shifted immediate in increments of two
-    if(is_set(opcode,25)) 
+    if(IMM) 
     {
         // how to calc the carry?
         const int imm = opcode & 0xff;
@@ -562,7 +703,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
 
     else // shifted register 
     {
-        Shift_type type = static_cast<Shift_type>((opcode >> 5 ) & 0x3);
+        constexpr Shift_type type = static_cast<Shift_type>(SHIFT_TYPE);
 
 
 
@@ -579,7 +720,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
 
         uint32_t shift_ammount = 0;
         // shift ammount is a register
-        if(is_set(opcode,4))
+        if(REG_SHIFT)
         {
             // bottom byte of rs (no r15)
             int rs = (opcode >> 8) & 0xf;
@@ -604,7 +745,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
         }
 
 
-        op2 = barrel_shift(type,imm,shift_ammount,shift_carry,!is_set(opcode,4));
+        op2 = barrel_shift(type,imm,shift_ammount,shift_carry,!REG_SHIFT);
     }
 
 
@@ -620,9 +761,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
     {
         if(cpu_mode >= USER)
         {
-            printf("illegal data processing s with pc %08x\n",regs[PC]);
-            print_regs();
-            exit(1);
+            throw Emu_error(fmt::format("illegal data processing s with pc {:08x}",regs[PC]));
         }
         
         else
@@ -632,15 +771,14 @@ void Cpu::arm_data_processing(uint32_t opcode)
     }
     
     // switch on the opcode to decide what to do
-    int op = (opcode >> 21) & 0xf;
-    switch(op)
+    switch(OP)
     {
         case 0x0: //and
         {
             regs[rd] = logical_and(op1,op2,update_flags);
             if(update_flags)
             {
-                cpsr = shift_carry? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+                set_carry_flag(shift_carry);
             }
             break;
         }
@@ -650,7 +788,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
             regs[rd] = logical_eor(op1,op2,update_flags);
             if(update_flags)
             {
-                cpsr = shift_carry? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+                set_carry_flag(shift_carry);
             }
             break;            
         }
@@ -697,7 +835,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
             logical_and(op1,op2,update_flags);
             if(update_flags)
             {
-                cpsr = shift_carry? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+                set_carry_flag(shift_carry);
             }             
             break;
         }
@@ -708,7 +846,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
             logical_eor(op1,op2,update_flags);
             if(update_flags)
             {
-                cpsr = shift_carry? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+                set_carry_flag(shift_carry);
             }            
             break;
         }
@@ -730,7 +868,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
             regs[rd] = logical_or(op1,op2,update_flags);
             if(update_flags)
             {
-                cpsr = shift_carry? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+                set_carry_flag(shift_carry);
             }            
             break;
         }
@@ -743,7 +881,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
             {
                 set_nz_flag(regs[rd]);
                 // carry is that of the shift oper
-                cpsr = shift_carry? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);                 
+                set_carry_flag(shift_carry);                 
             }
             break;
         }
@@ -754,7 +892,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
             regs[rd] = bic(op1,op2,update_flags);
             if(update_flags)
             {
-                cpsr = shift_carry? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+                set_carry_flag(shift_carry);
             }            
             break;
         }
@@ -767,7 +905,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
             {
                 set_nz_flag(regs[rd]);
                 // carry is that of the shift oper
-                cpsr = shift_carry? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);                 
+                set_carry_flag(shift_carry);                 
             }
 
 
@@ -776,7 +914,7 @@ void Cpu::arm_data_processing(uint32_t opcode)
 
         default:
         {
-            printf("cpu unknown data processing instruction %x!\n",op);
+            printf("cpu unknown data processing instruction %x!\n",OP);
             arm_unknown(opcode);
             break;
         }
@@ -817,16 +955,17 @@ void Cpu::arm_branch_and_exchange(uint32_t opcode)
 
 // halfword doubleword signed data transfer
 // <-- handle instr timings
+template<const bool P, const bool U, const bool I, const bool W, const bool L, const int OP>
 void Cpu::arm_hds_data_transfer(uint32_t opcode)
 {
-    bool p = is_set(opcode,24);
-    bool u = is_set(opcode,23);
-    bool i = is_set(opcode,22);
-    bool l = is_set(opcode,20);
+    constexpr bool p = P;
+    constexpr bool u = U;
+    constexpr bool i = I;
+    constexpr bool l = L;
     int rn = (opcode >> 16) & 0xf;
     int rd = (opcode >> 12) & 0xf;
-    int op = (opcode >> 5) & 0x3;
-    bool w = is_set(opcode,21);
+    constexpr int op = OP;
+    constexpr bool w = W;
 
 
 
@@ -920,9 +1059,7 @@ void Cpu::arm_hds_data_transfer(uint32_t opcode)
             
             default: // doubleword ops not supported on armv4
             {
-                printf("hds illegal store op: %08x\n",regs[PC]);
-                print_regs();
-                exit(1);
+                throw Emu_error(fmt::format("hds illegal store op: {:08x}",regs[PC]));
             }
 
         }
@@ -946,20 +1083,19 @@ void Cpu::arm_hds_data_transfer(uint32_t opcode)
 }
 
 // ldr , str
+template<const bool REG_OFFSET, const bool P, const bool U, const bool B, const bool W, const bool L>
 void Cpu::arm_single_data_transfer(uint32_t opcode)
 {
 
     int cycles = 0;
 
-    bool load = is_set(opcode,20);
-    bool w = is_set(opcode,21); // write back
-    bool p = is_set(opcode,24); // pre index
+    constexpr bool load = L;
+    constexpr bool w = W; // write back
+    constexpr bool p = P; // pre index
 
     if(!p && w) // operate it in a seperate mode
     {
-        printf("T present operate load/store in user mode: : %08x!\n",regs[PC]);
-        print_regs();
-        exit(1);
+        throw Emu_error(fmt::format("T present operate load/store in user mode: : {:08x}!",regs[PC]));
     }
 
 
@@ -976,7 +1112,7 @@ void Cpu::arm_single_data_transfer(uint32_t opcode)
 
     uint32_t offset;
 
-    if(is_set(opcode,25))
+    if(REG_OFFSET)
     {
         Shift_type type = static_cast<Shift_type>((opcode >> 5 ) & 0x3);
 
@@ -989,7 +1125,7 @@ void Cpu::arm_single_data_transfer(uint32_t opcode)
         // register specified shift ammounts are not allowed
         int shift_ammount = (opcode >> 7) & 0x1f;
         
-        bool carry = is_set(cpsr,C_BIT);
+        bool carry = get_carry_flag();
         offset = barrel_shift(type,imm,shift_ammount,carry,true);
     }
 
@@ -1001,11 +1137,11 @@ void Cpu::arm_single_data_transfer(uint32_t opcode)
 
 
     //byte / word bit
-    bool is_byte = is_set(opcode,22);
+    constexpr bool is_byte = B;
 
     // up or down bit decides wether we add
     // or subtract the offest
-    bool u = is_set(opcode,23);
+    constexpr bool u = U;
 
     // up / down bit decides wether to add or subtract
     // the offset
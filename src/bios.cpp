@@ -0,0 +1,463 @@
+#include "headers/cpu.h"
+#include "headers/memory.h"
+
+
+// bios irq handler ors the interrupts it serviced in here
+constexpr uint32_t BIOS_IF = 0x03007ff8;
+
+
+// high level emulation of bios calls
+// anything not handled here runs through the real bios
+bool Cpu::hle_swi(int nn, uint32_t swi_pc)
+{
+    switch(nn)
+    {
+        case 0x02: // Halt
+        {
+            halted = true;
+            return true;
+        }
+
+        case 0x04: // IntrWait
+        {
+            intr_wait(regs[0] != 0,regs[1],swi_pc);
+            return true;
+        }
+
+        case 0x05: // VBlankIntrWait
+        {
+            regs[0] = 1;
+            regs[1] = 1;
+            intr_wait(true,1,swi_pc);
+            return true;
+        }
+
+        default:
+        {
+            break;
+        }
+    }
+
+    if(!hle_bios)
+    {
+        return false;
+    }
+
+    switch(nn)
+    {
+        case 0x06: // Div
+        {
+            swi_div(regs[0],regs[1]);
+            return true;
+        }
+
+        case 0x07: // DivArm
+        {
+            swi_div(regs[1],regs[0]);
+            return true;
+        }
+
+        case 0x08: // Sqrt
+        {
+            swi_sqrt();
+            return true;
+        }
+
+        case 0x0b: // CpuSet
+        {
+            swi_cpu_set();
+            return true;
+        }
+
+        case 0x0c: // CpuFastSet
+        {
+            swi_cpu_fast_set();
+            return true;
+        }
+
+        case 0x11: // LZ77UnCompWram
+        case 0x12: // LZ77UnCompVram
+        {
+            swi_lz77_uncomp(nn == 0x12);
+            return true;
+        }
+
+        case 0x13: // HuffUnComp
+        {
+            swi_huff_uncomp();
+            return true;
+        }
+
+        case 0x14: // RLUnCompWram
+        case 0x15: // RLUnCompVram
+        {
+            swi_rl_uncomp(nn == 0x15);
+            return true;
+        }
+
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+// halt untill one of the flags gets set by the irq handler
+// we cant wait inside the swi as the handler has to run
+// so just halt and rerun the swi when the handler returns to it
+void Cpu::intr_wait(bool discard, uint16_t flags, uint32_t swi_pc)
+{
+    // bios allways turns ime on
+    mem->write_mem<uint16_t>(0x04000000 | IO_IME,1);
+
+    uint16_t bios_if = mem->read_mem<uint16_t>(BIOS_IF);
+
+    // with irqs masked the handler never runs to set the bios flags
+    // so the flags have to be checked (and acked) in if directly
+    const uint16_t intr_flag = is_set(cpsr,7)? mem->read_mem<uint16_t>(0x04000000 | IO_IF) & flags : 0;
+
+    // only throw away old flags the first time round
+    if(discard && !intr_waiting)
+    {
+        bios_if &= ~flags;
+        mem->write_mem<uint16_t>(BIOS_IF,bios_if);
+
+        if(intr_flag)
+        {
+            mem->write_mem<uint16_t>(0x04000000 | IO_IF,intr_flag);
+        }
+    }
+
+    else if((bios_if & flags) || intr_flag)
+    {
+        mem->write_mem<uint16_t>(BIOS_IF,bios_if & ~flags);
+
+        // writing a 1 acks it
+        if(intr_flag)
+        {
+            mem->write_mem<uint16_t>(0x04000000 | IO_IF,intr_flag);
+        }
+
+        intr_waiting = false;
+        return;
+    }
+
+    intr_waiting = true;
+    halted = true;
+    regs[PC] = swi_pc;
+}
+
+
+// rough cost of the bios routines that dont touch memory
+constexpr int DIV_CYCLES = 60;
+constexpr int SQRT_CYCLES = 80;
+
+void Cpu::swi_div(int32_t num, int32_t den)
+{
+    // the bios hangs on this but dont take the emulator with it
+    if(den == 0)
+    {
+        regs[0] = num < 0? -1 : 1;
+        regs[1] = num;
+        regs[3] = 1;
+    }
+
+    else
+    {
+        // done in 64 bit so INT_MIN / -1 cant overflow
+        const int64_t quot = static_cast<int64_t>(num) / den;
+        const int64_t rem = static_cast<int64_t>(num) % den;
+
+        regs[0] = static_cast<uint32_t>(quot);
+        regs[1] = static_cast<uint32_t>(rem);
+        regs[3] = static_cast<uint32_t>(quot < 0? -quot : quot);
+    }
+
+    cycle_tick(DIV_CYCLES);
+}
+
+void Cpu::swi_sqrt()
+{
+    uint32_t v = regs[0];
+    uint32_t res = 0;
+    uint32_t bit = 1 << 30;
+
+    while(bit > v)
+    {
+        bit >>= 2;
+    }
+
+    while(bit != 0)
+    {
+        if(v >= res + bit)
+        {
+            v -= res + bit;
+            res = (res >> 1) + bit;
+        }
+
+        else
+        {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    regs[0] = res;
+    cycle_tick(SQRT_CYCLES);
+}
+
+
+// copy / fill cnt units
+// contiguous memory goes through the same bulk copy as dma
+// which charges all the accesses in one go, anything else (io, crossing a mirror,
+// overlapping copies) is done a unit at a time with each access ticked as the bios loop would
+template<typename access_type>
+static void bios_copy(Mem *mem, uint32_t src, uint32_t dst, uint32_t cnt, bool fill)
+{
+    constexpr uint32_t size = sizeof(access_type);
+    src &= ~(size - 1);
+    dst &= ~(size - 1);
+
+    if(!cnt || mem->dma_copy(src,dst,cnt,size == ARM_HALF_SIZE,fill))
+    {
+        return;
+    }
+
+    const access_type v = fill? mem->read_memt<access_type>(src) : 0;
+
+    for(uint32_t i = 0; i < cnt; i++)
+    {
+        if(fill)
+        {
+            mem->write_memt<access_type>(dst,v);
+        }
+
+        else
+        {
+            mem->write_memt<access_type>(dst,mem->read_memt<access_type>(src));
+            src += size;
+        }
+        dst += size;
+    }
+}
+
+void Cpu::swi_cpu_set()
+{
+    const uint32_t cnt = regs[2] & 0x1fffff;
+    const bool fill = is_set(regs[2],24);
+
+    if(is_set(regs[2],26))
+    {
+        bios_copy<uint32_t>(mem,regs[0],regs[1],cnt,fill);
+    }
+
+    else
+    {
+        bios_copy<uint16_t>(mem,regs[0],regs[1],cnt,fill);
+    }
+}
+
+void Cpu::swi_cpu_fast_set()
+{
+    // allways done in blocks of 8 words
+    const uint32_t cnt = ((regs[2] & 0x1fffff) + 7) & ~7;
+    bios_copy<uint32_t>(mem,regs[0],regs[1],cnt,is_set(regs[2],24));
+}
+
+
+// all the decompressors unpack into a buffer first
+// the wram variants write bytes so any dst works, the vram ones
+// write in halfwords as vram cant take byte writes (and so align dst like the bios does)
+void Cpu::write_uncomp(uint32_t dst, const std::vector<uint8_t> &out, bool vram)
+{
+    if(!vram)
+    {
+        for(size_t i = 0; i < out.size(); i++)
+        {
+            mem->write_memt<uint8_t>(dst+i,out[i]);
+        }
+        return;
+    }
+
+    dst &= ~1;
+    size_t i = 0;
+    for(; i + 1 < out.size(); i += 2)
+    {
+        mem->write_memt<uint16_t>(dst+i,out[i] | (out[i+1] << 8));
+    }
+
+    if(i < out.size())
+    {
+        mem->write_memt<uint8_t>(dst+i,out[i]);
+    }
+}
+
+void Cpu::swi_lz77_uncomp(bool vram)
+{
+    uint32_t src = regs[0] & ~3;
+    const uint32_t size = mem->read_memt<uint32_t>(src) >> 8;
+    src += 4;
+
+    std::vector<uint8_t> out;
+    out.reserve(size);
+
+    while(out.size() < size)
+    {
+        const uint8_t flags = mem->read_memt<uint8_t>(src++);
+
+        for(int i = 7; i >= 0 && out.size() < size; i--)
+        {
+            // compressed, copy from allready unpacked data
+            if(is_set(flags,i))
+            {
+                const uint8_t b0 = mem->read_memt<uint8_t>(src++);
+                const uint8_t b1 = mem->read_memt<uint8_t>(src++);
+
+                const size_t disp = (((b0 & 0xf) << 8) | b1) + 1;
+                const int len = (b0 >> 4) + 3;
+
+                for(int j = 0; j < len && out.size() < size; j++)
+                {
+                    // bad data that points before the start
+                    out.push_back(disp <= out.size()? out[out.size() - disp] : 0);
+                }
+            }
+
+            else
+            {
+                out.push_back(mem->read_memt<uint8_t>(src++));
+            }
+        }
+    }
+
+    write_uncomp(regs[1],out,vram);
+}
+
+void Cpu::swi_rl_uncomp(bool vram)
+{
+    uint32_t src = regs[0] & ~3;
+    const uint32_t size = mem->read_memt<uint32_t>(src) >> 8;
+    src += 4;
+
+    std::vector<uint8_t> out;
+    out.reserve(size);
+
+    while(out.size() < size)
+    {
+        const uint8_t flag = mem->read_memt<uint8_t>(src++);
+
+        // run of one byte
+        if(is_set(flag,7))
+        {
+            const int len = (flag & 0x7f) + 3;
+            const uint8_t v = mem->read_memt<uint8_t>(src++);
+
+            for(int i = 0; i < len && out.size() < size; i++)
+            {
+                out.push_back(v);
+            }
+        }
+
+        // uncompressed bytes
+        else
+        {
+            const int len = (flag & 0x7f) + 1;
+
+            for(int i = 0; i < len && out.size() < size; i++)
+            {
+                out.push_back(mem->read_memt<uint8_t>(src++));
+            }
+        }
+    }
+
+    write_uncomp(regs[1],out,vram);
+}
+
+void Cpu::swi_huff_uncomp()
+{
+    const uint32_t src = regs[0] & ~3;
+    const uint32_t header = mem->read_memt<uint32_t>(src);
+    const uint32_t size = header >> 8;
+    const int bits = (header & 0xf) == 4? 4 : 8;
+
+    // tree size byte is followed by the root node
+    const uint32_t tree = src + 4;
+    const uint32_t root = tree + 1;
+    uint32_t data = tree + ((mem->read_memt<uint8_t>(tree) + 1) * 2);
+
+    uint32_t node_addr = root;
+    uint8_t node = mem->read_memt<uint8_t>(node_addr);
+
+    uint32_t word = 0;
+    int word_bits = 0;
+
+    std::vector<uint8_t> out;
+    out.reserve(size + 3);
+
+    while(out.size() < size)
+    {
+        const uint32_t stream = mem->read_memt<uint32_t>(data);
+        data += 4;
+
+        // bits are read msb first
+        for(int i = 31; i >= 0 && out.size() < size; i--)
+        {
+            const int bit = is_set(stream,i);
+
+            // bit 7 flags node0 as data, bit 6 node1
+            const bool is_data = is_set(node,7 - bit);
+            node_addr = (node_addr & ~1) + ((node & 0x3f) * 2) + 2 + bit;
+            node = mem->read_memt<uint8_t>(node_addr);
+
+            if(!is_data)
+            {
+                continue;
+            }
+
+            word |= (node & ((1 << bits) - 1)) << word_bits;
+            word_bits += bits;
+
+            // output is done a word at a time
+            if(word_bits == 32)
+            {
+                for(int j = 0; j < 4; j++)
+                {
+                    out.push_back((word >> (j * 8)) & 0xff);
+                }
+                word = 0;
+                word_bits = 0;
+            }
+
+            node_addr = root;
+            node = mem->read_memt<uint8_t>(node_addr);
+        }
+    }
+
+    // output is in words so dst is word aligned
+    write_uncomp(regs[1] & ~3,out,true);
+}
+
+
+void Cpu::enter_swi()
+{
+    // spsr for supervisor = cpsr
+    calc_flags();
+    status_banked[SUPERVISOR] = cpsr;
+
+    // supervisor mode switch
+    switch_mode(SUPERVISOR);
+
+    // lr in supervisor mode set to return addr
+    regs[LR] = regs[PC];
+
+    
+    // switch to arm mode
+    is_thumb = false; // switch to arm mode
+    cpsr = deset_bit(cpsr,5); // toggle thumb in cpsr
+    cpsr = set_bit(cpsr,7); //set the irq bit to mask interrupts
+    update_irq_pending();
+
+    // branch to interrupt vector
+    regs[PC] = 0x8;
+    cycle_tick(3); // 2s + 1n;
+}
@@ -0,0 +1,156 @@
+#include "headers/cpu.h"
+#include "headers/memory.h"
+
+
+// only bios, wram and rom are worth caching
+// (code in vram etc is rare and writes to it are not tracked)
+static bool is_cacheable(uint32_t addr)
+{
+    switch((addr >> 24) & 0xf)
+    {
+        case 0x0: // bios
+        case 0x8: // rom (all wait states)
+        case 0x9:
+        case 0xa:
+        case 0xb:
+        case 0xc:
+        case 0xd:
+        case 0x2: // board wram
+        case 0x3: // chip wram
+        {
+            return true;
+        }
+
+        default: return false;
+    }
+}
+
+static bool is_ram(uint32_t addr)
+{
+    const uint32_t region = (addr >> 24) & 0xf;
+    return region == 0x2 || region == 0x3;
+}
+
+
+void Cpu::decode_block_instr(Arm_block_instr &instr, uint32_t addr)
+{
+    instr.opcode = mem->read_mem<uint32_t>(addr);
+    instr.fetch_cycles = mem->get_access_cycles(WORD);
+    instr.handler = arm_opcode_table[get_arm_opcode_bits(instr.opcode)];
+}
+
+void Cpu::decode_block_instr(Thumb_block_instr &instr, uint32_t addr)
+{
+    instr.opcode = mem->read_mem<uint16_t>(addr);
+    instr.fetch_cycles = mem->get_access_cycles(HALF);
+    instr.handler = thumb_opcode_table[get_thumb_exec_bits(instr.opcode)];
+}
+
+
+// fetch the instr at the pc out of the cache
+// decoding it if this is the first time we have got to it
+template<typename instr_type>
+instr_type Cpu::fetch_block_instr(Block_cache<instr_type> &cache)
+{
+    constexpr uint32_t size = sizeof(instr_type::opcode);
+    const uint32_t pc = regs[PC];
+
+    instr_type instr;
+
+    if(!is_cacheable(pc))
+    {
+        decode_block_instr(instr,pc);
+    }
+
+    else
+    {
+        Block<instr_type> *block = cache.cur;
+
+        // will wrap to a huge idx if the pc is behind the block
+        uint32_t idx = block? (pc - block->addr) / size : 0;
+
+        // not inside or just past the end of the current block
+        // so find the one that starts here
+        if(!block || idx > block->instrs.size() || idx >= MAX_BLOCK_SIZE)
+        {
+            auto &blocks = is_ram(pc)? cache.ram_blocks : cache.rom_blocks;
+
+            auto it = blocks.find(pc);
+            if(it == blocks.end())
+            {
+                it = blocks.emplace(pc,Block<instr_type>{pc,{}}).first;
+                it->second.instrs.reserve(MAX_BLOCK_SIZE);
+            }
+
+            block = &it->second;
+            cache.cur = block;
+            idx = 0;
+        }
+
+        // first time we have executed this far into the block
+        if(idx == block->instrs.size())
+        {
+            decode_block_instr(instr,pc);
+            block->instrs.push_back(instr);
+            mem->mark_code_page(pc);
+        }
+
+        // copy it out as the block may be invalidated by the instr itself
+        instr = block->instrs[idx];
+    }
+
+    cycle_tick(instr.fetch_cycles);
+    regs[PC] += size;
+    return instr;
+}
+
+Cpu::Arm_block_instr Cpu::fetch_arm_opcode()
+{
+    return fetch_block_instr(arm_block_cache);
+}
+
+Cpu::Thumb_block_instr Cpu::fetch_thumb_opcode()
+{
+    return fetch_block_instr(thumb_block_cache);
+}
+
+
+template<typename instr_type>
+void Cpu::invalidate_block_cache(Block_cache<instr_type> &cache, uint32_t addr)
+{
+    constexpr uint32_t size = sizeof(instr_type::opcode);
+
+    // wram is mirrored so compare offsets not addresses
+    const uint32_t region = (addr >> 24) & 0xf;
+    const uint32_t mask = region == 0x2? 0x3ffff : 0x7fff;
+
+    const uint32_t page_start = addr & mask;
+    const uint32_t page_end = page_start + Mem::CODE_PAGE_SIZE;
+
+    for(auto it = cache.ram_blocks.begin(); it != cache.ram_blocks.end();)
+    {
+        const auto &block = it->second;
+        const uint32_t start = block.addr & mask;
+        const uint32_t end = start + (block.instrs.size() * size);
+
+        if(((block.addr >> 24) & 0xf) == region && start < page_end && end > page_start)
+        {
+            it = cache.ram_blocks.erase(it);
+        }
+
+        else
+        {
+            ++it;
+        }
+    }
+
+    // current block may be gone
+    cache.cur = nullptr;
+}
+
+void Cpu::invalidate_blocks(uint32_t addr)
+{
+    invalidate_block_cache(arm_block_cache,addr);
+    invalidate_block_cache(thumb_block_cache,addr);
+    jit.invalidate(addr);
+}
@@ -3,15 +3,53 @@
 #include "headers/display.h"
 #include "headers/debugger.h"
 #include "headers/disass.h"
+#include "headers/scheduler.h"
 #include <limits.h>
 
-void Cpu::init(Display *disp, Mem *mem, Debugger *debug, Disass *disass)
+// slot in banked_regs each mode keeps r8 - r14 in
+static constexpr std::array<std::array<int,7>,7> gen_bank_table()
+{
+    std::array<std::array<int,7>,7> table{};
+
+    for(int mode = 0; mode < 7; mode++)
+    {
+        for(int i = 0; i < 7; i++)
+        {
+            const int reg = i + 8;
+
+            if(mode == FIQ)
+            {
+                table[mode][i] = 7 + i;
+            }
+
+            // shares user regs
+            else if(reg < SP || mode == USER || mode == SYSTEM)
+            {
+                table[mode][i] = i;
+            }
+
+            // sp and lr banked (svc, abt, irq, und)
+            else
+            {
+                table[mode][i] = 14 + ((mode - 1) * 2) + (reg - SP);
+            }
+        }
+    }
+
+    return table;
+}
+
+static constexpr auto bank_table = gen_bank_table();
+
+
+void Cpu::init(Display *disp, Mem *mem, Debugger *debug, Disass *disass, Scheduler *scheduler)
 {
     // init components
     this->disp = disp;
     this->mem = mem;
     this->debug = debug;
     this->disass = disass;
+    this->scheduler = scheduler;
 
     // setup main cpu state
     cpu_mode = SYSTEM; // system mode
@@ -20,8 +58,14 @@ void Cpu::init(Display *disp, Mem *mem, Debugger *debug, Disass *disass)
     regs[LR] = 0x08000000;
     cpsr = 0x1f;
     regs[SP] = 0x03007f00;
-    hi_banked[SUPERVISOR][0] = 0x03007FE0;
-    hi_banked[IRQ][0] = 0x03007FA0;
+    banked_regs[bank_table[SUPERVISOR][SP-8]] = 0x03007FE0;
+    banked_regs[bank_table[IRQ][SP-8]] = 0x03007FA0;
+
+    // timers
+    memset(timers,0,sizeof(timers));
+
+    jit.init(mem);
+
     //arm_fill_pipeline(); // fill the intitial cpu pipeline
     //regs[PC] = 0;
     init_opcode_table();
@@ -34,329 +78,122 @@ void Cpu::init_opcode_table()
     init_thumb_opcode_table();
 }
 
-void Cpu::init_thumb_opcode_table()
-{
-    thumb_opcode_table.resize(256);
 
-    for(int i = 0; i < 256; i++)
-    {
-
-         // THUMB.11: load/store SP-relative
-        if(((i >> 4) & 0b1111) == 0b1001)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_load_store_sp;
-        }
-
-        // THUMB.13: add offset to stack pointer
-        else if(i == 0b10110000)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_sp_add;
-        }
-
-        // THUMB.17: software interrupt and breakpoint
-        else if(i  == 0b11011111)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_swi;
-        }
-
-        // THUMB.8: load/store sign-extended byte/halfword
-        else if(((i >> 4) & 0b1111) == 0b0101 && is_set(i,1))
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_load_store_sbh;
-        }
-
-        // THUMB.7: load/store with register offset
-        else if(((i >> 4) & 0b1111) == 0b0101 && !is_set(i,1))
-        {
-           thumb_opcode_table[i] = &Cpu::thumb_load_store_reg;
-        }
-
-        // THUMB.12: get relative address
-        else if(((i >> 4) & 0b1111) == 0b1010)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_get_rel_addr;
-        }
-        
-        // THUMB.18: unconditional branch
-        else if(((i >> 3) & 0b11111) == 0b11100)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_branch;
-        }
-
-        //THUMB.10: load/store halfword
-        else if(((i >> 4) & 0b1111) == 0b1000)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_load_store_half;
-        }
 
-        //THUMB.14: push/pop registers
-        else if(((i >> 4) & 0b1111) == 0b1011 
-            && ((i >> 1) & 0b11) == 0b10)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_push_pop;
-        }
-
-        // THUMB.9: load/store with immediate offset
-        else if(((i>>5) & 0b111) == 0b011)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_ldst_imm;
-        }
-
-
-        // THUMB.5: Hi register operations/branch exchange
-        else if(((i >> 2) & 0b111111) == 0b010001)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_hi_reg_ops;
-        }
-
-        //  THUMB.15: multiple load/store
-        else if(((i >> 4) & 0b1111) == 0b1100)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_multiple_load_store;
-        }
-
-        // THUMB.2: add/subtract
-        else if(((i >> 3) & 0b11111) == 0b00011)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_add_sub;
-        }
-
-        // THUMB.4: ALU operations
-        else if(((i >> 2) & 0b111111) == 0b010000)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_alu;
-        }
-
-        // THUMB.19: long branch with link
-        else if(((i >> 4) & 0b1111) == 0b1111)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_long_bl;
-        }
-
-        // THUMB.6: load PC-relative
-        else if(((i >> 3) & 0b11111) ==  0b01001)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_ldr_pc;
-        }
-
-        // THUMB.3: move/compare/add/subtract immediate
-        else if(((i >> 5) & 0b111) == 0b001)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_mcas_imm;
-        }
-
-        // THUMB.1: move shifted register
-        // top 3 bits unset
-        else if(((i >> 5) & 0b111) == 0b000)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_mov_reg_shift;
-        }
-
-        // THUMB.16: conditional branch
-        else if(((i >> 4)  & 0b1111) == 0b1101)
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_cond_branch;
-        }
-
-        else 
-        {
-            thumb_opcode_table[i] = &Cpu::thumb_unknown;
-        }                 
-    }
-}
-
-void Cpu::init_arm_opcode_table()
+// nothing is ticked directly anymore
+// the scheduler calls out when something is actually due
+void Cpu::cycle_tick(int cycles)
 {
-    arm_opcode_table.resize(4096);
+    scheduler->tick(cycles);
+}
 
 
-    for(int i = 0; i < 4096; i++)
+// get this booting into armwrestler
+// by skipping the state forward
+void Cpu::step()
+{
+    if(halted)
     {
-        switch(i >> 10) // bits 27 and 26 of opcode
-        {
-            case 0b00:
-            {
-                int op = (i >> 5) & 0xf;
-
-                //  ARM.7: Multiply and Multiply-Accumulate (MUL,MLA)
-                if(((i & 0b1111) == 0b1001) && ((i >> 7) & 0b111111) == 0b000000) 
-                {
-                    arm_opcode_table[i] = &Cpu::arm_mul;
-                }
-
-                //  multiply and accumulate long
-                else if(((i & 0b1111) == 0b1001) && ((i >> 7) & 0b111111) == 0b000001) 
-                {
-                    arm_opcode_table[i] = &Cpu::arm_mull;
-                }
-
-
-                // Single Data Swap (SWP)  
-                else if(((i & 0b1111) == 0b1001) && ((i >> 7) & 0b11111) == 0b00010 && ((i >> 4) & 0b11) == 0b00)
-                {
-                    arm_opcode_table[i] = &Cpu::arm_swap;
-                }
-
-
-
-                // ARM.10: Halfword, Doubleword, and Signed Data Transfer
-                // (may require more stringent checks than this)
-                // think this might cause conflicts?
-                else if(((i >> 9) & 0b111) == 0b000 && is_set(i,3) && is_set(i,0))
-                {
-                   arm_opcode_table[i] = &Cpu::arm_hds_data_transfer;
-                }
-
-
-                //ARM.3: Branch and Exchange
-                // bx
-                else if(i == 0b000100100001) // <--- start here
-                {
-                    arm_opcode_table[i] = &Cpu::arm_branch_and_exchange;
-                }
-
-
-                // msr and mrs
-                // ARM.6: PSR Transfer
-                // bit 24-23 must be 10 for this instr
-                // bit 20 must also be zero
-                
-                // check it ocupies the unused space for
-                //TST,TEQ,CMP,CMN with a S of zero
-                else if(op >= 0x8 && op <= 0xb && !is_set(i,4))
-                {
-                    arm_opcode_table[i] = &Cpu::arm_psr;
-                }
-
-                //  ARM.5: Data Processing 00 at bit 27
-                else
-                { 
-                    arm_opcode_table[i] = &Cpu::arm_data_processing;
-                }
-                break;
-            }
-
-            case 0b01:
-            {
-                //ARM.9: Single Data Transfer
-                if(true) // assume for now
-                {
-                    arm_opcode_table[i] = &Cpu::arm_single_data_transfer;   
-                }
-
-                else 
-                {
-                    arm_opcode_table[i] = &Cpu::arm_unknown;
-                }
-                break;
-            }
-
-            case 0b10:
-            {
-
-                // 101 (ARM.4: Branch and Branch with Link)
-                if(is_set(i,9))
-                {
-                    arm_opcode_table[i] = &Cpu::arm_branch;
-                }
-
-
-                // 100
-                // ARM.11: Block Data Transfer (LDM,STM)
-                else if(!is_set(i,9))
-                {
-                    arm_opcode_table[i] = &Cpu::arm_block_data_transfer;
-                }
-
+        handle_halt();
+    }
 
-                else 
-                {
-                    arm_opcode_table[i] = &Cpu::arm_unknown;
-                }
+    else if(jit.is_enabled() && regs[PC] != jit_seq_pc && exec_jit())
+    {
+        // next instr was not interpreted so always look it up
+        jit_seq_pc = 0xffffffff;
+    }
 
-                break;
-            }
+    else if(is_thumb) // step the cpu in thumb mode
+    {
+        const uint32_t pc = regs[PC] & ~1;
+        exec_thumb();
+        jit_seq_pc = pc + ARM_HALF_SIZE;
+    }
 
-            case 0b11:
-            {
-                arm_opcode_table[i] = &Cpu::arm_unknown;
-                break;
-            }
-        } 
+    else // step the cpu in arm mode
+    {
+        const uint32_t pc = regs[PC] & ~3;
+        exec_arm();
+        jit_seq_pc = pc + ARM_WORD_SIZE;
     }
 
+    // handle interrupts
+    do_interrupts();
 }
 
-void Cpu::cycle_tick(int cycles)
+// no instrs run while halted so the only thing that can
+// wake us up is an event, skip straight to the next one
+void Cpu::handle_halt()
 {
-    disp->tick(cycles);
-    tick_timers(cycles);
+    if(!irq_requested)
+    {
+        cycle_tick(scheduler->get_next_event_cycles());
+    }
+
+    halted = !irq_requested;
 }
 
-void Cpu::tick_timers(int cycles)
+// called after a branch is taken
+void Cpu::check_idle_loop(uint32_t branch_pc)
 {
+    const uint32_t target = regs[PC];
 
-    static constexpr uint32_t timer_lim[4] = {1,64,256,1024};
-    static constexpr Interrupt interrupt_table[4] = {Interrupt::TIMER0,Interrupt::TIMER1,Interrupt::TIMER2,Interrupt::TIMER3};
- 
-    // ignore count up timing for now
-    for(int i = 0; i < 4; i++)
+    // only short backward jumps
+    if(target > branch_pc || branch_pc - target > IDLE_LOOP_SIZE)
     {
-        int offset = i*ARM_WORD_SIZE;
-        uint16_t cnt = mem->handle_read<uint16_t>(mem->io,IO_TM0CNT_H+offset);
-
-        if(!is_set(cnt,7)) // timer is not enabled
-        {
-            continue;
-        }
-
-        if(is_set(cnt,2)) // count up timer
-        {
-            puts("count up timer!");
-            exit(1);
-        }
-
-        uint32_t lim = timer_lim[cnt & 0x3];
+        return;
+    }
 
-       // printf("%08x\n",lim);
+    calc_flags();
+    const uint32_t writes = mem->get_write_count();
+    const uint64_t events = scheduler->get_events_serviced();
 
-        timer_scale[i] += cycles;
+    // state is the same as last time round and nothing was written
+    // so the loop cant see anything new untill the next event
+    // (if an event ran during the last time round the loop may not have seen
+    // what it changed yet, and a pending irq has to be serviced first)
+    if(target == idle_loop_pc && writes == idle_loop_writes && events == idle_loop_events
+        && !idle_timer_read && !irq_pending && !irq_requested
+        && cpsr == idle_loop_cpsr && memcmp(regs,idle_loop_regs,sizeof(idle_loop_regs)) == 0)
+    {
+        cycle_tick(scheduler->get_next_event_cycles());
+    }
 
-        if(timer_scale[i] >= lim)
-        {
-            timers[i] += timer_scale[i] / lim;
-            uint32_t max_cyc = std::numeric_limits<uint16_t>::max();
-            if(timers[i] >= max_cyc) // overflowed
-            {
-                // add the reload values
-                timers[i] = mem->handle_read<uint16_t>(mem->io,IO_TM0CNT_L+offset) + timers[i] % max_cyc;
-                if(is_set(cnt,6))
-                {
-                    request_interrupt(interrupt_table[i]);
-                }
-            }
-            timer_scale[i] %= lim;
-        }
-    }    
+    idle_loop_pc = target;
+    idle_loop_cpsr = cpsr;
+    idle_loop_writes = mem->get_write_count();
+    idle_loop_events = scheduler->get_events_serviced();
+    idle_timer_read = false;
+    memcpy(idle_loop_regs,regs,sizeof(idle_loop_regs));
 }
 
-
-// get this booting into armwrestler
-// by skipping the state forward
-void Cpu::step()
+bool Cpu::exec_jit()
 {
-    if(is_thumb) // step the cpu in thumb mode
+#ifdef DEBUG
+    // breakpoints are only checked by the interpreter
+    if(debug->breakpoint_x.break_enabled || debug->step_instr)
     {
-        exec_thumb();
+        return false;
     }
+#endif
 
-    else // step the cpu in arm mode
+    const uint32_t pc = regs[PC] & (is_thumb? ~1 : ~3);
+
+    const Jit::Jit_block *block = jit.lookup(pc,is_thumb);
+    if(!block)
     {
-        exec_arm();
+        return false;
     }
 
-    // handle interrupts
-    do_interrupts();
+    // copy these out as the block can be invalidated while it runs
+    const auto code = block->code;
+    const int cycles = block->cycles;
+
+    // none of the compiled instrs read the pc
+    regs[PC] = pc + block->size;
+    jit.run(code,regs);
+    cycle_tick(cycles);
+    return true;
 }
 
 // start here
@@ -366,7 +203,7 @@ void Cpu::print_regs()
 
     // update current registers
     // so they can be printed
-    store_registers(cpu_mode);
+    store_banked_regs();
 
 
     printf("current mode: %s\n",mode_names[cpu_mode]);
@@ -376,7 +213,8 @@ void Cpu::print_regs()
 
     for(int i = 0; i < 16; i++)
     {
-        printf("%s: %08x ",user_regs_names[i],user_regs[i]);
+        const bool banked = i >= 8 && i != PC;
+        printf("%s: %08x ",user_regs_names[i],banked? banked_regs[bank_table[USER][i-8]] : regs[i]);
         if((i % 2) == 0)
         {
             putchar('\n');
@@ -389,7 +227,7 @@ void Cpu::print_regs()
 
     for(int i = 0; i < 5; i++)
     {
-        printf("%s: %08x ",fiq_banked_names[i],fiq_banked[i]);
+        printf("%s: %08x ",fiq_banked_names[i],banked_regs[bank_table[FIQ][i]]);
         if((i % 2) == 0)
         {
             putchar('\n');
@@ -400,8 +238,8 @@ void Cpu::print_regs()
 
     for(int i = 0; i < 5; i++)
     {
-        printf("%s: %08x %s: %08x\n",hi_banked_names[i][0],hi_banked[i][0],
-            hi_banked_names[i][1],hi_banked[i][1]);
+        printf("%s: %08x %s: %08x\n",hi_banked_names[i][0],banked_regs[bank_table[i][SP-8]],
+            hi_banked_names[i][1],banked_regs[bank_table[i][LR-8]]);
     }
 
     puts("\nSTAUS BANKED");
@@ -416,6 +254,7 @@ void Cpu::print_regs()
     }
 
 
+    calc_flags();
     printf("\ncpsr: %08x\n",cpsr);
 
     puts("FLAGS");
@@ -428,25 +267,78 @@ void Cpu::print_regs()
 }
 
 
+void Cpu::calc_flags()
+{
+    uint32_t flags = 0;
+
+    switch(flag_op)
+    {
+        case Flag_op::NONE: return;
+
+        case Flag_op::LOGICAL:
+        {
+            flags = flag_carry << C_BIT;
+            flags |= cpsr & (1 << V_BIT);
+            break;
+        }
+
+        case Flag_op::ADD:
+        {
+            flags = (flag_res < flag_v1) << C_BIT;
+
+            // sign of the result differs from both operands
+            flags |= (((flag_v1 ^ flag_res) & (flag_v2 ^ flag_res)) >> 31) << V_BIT;
+            break;
+        }
+
+        case Flag_op::SUB:
+        {
+            flags = (flag_v1 >= flag_v2) << C_BIT;
+
+            // operands had different signs and the result
+            // has a different sign to the first
+            flags |= (((flag_v1 ^ flag_v2) & (flag_v1 ^ flag_res)) >> 31) << V_BIT;
+            break;
+        }
+    }
+
+    flags |= (flag_res == 0) << Z_BIT;
+    flags |= flag_res & (1 << N_BIT);
+
+    cpsr = (cpsr & 0x0fffffff) | flags;
+    flag_op = Flag_op::NONE;
+}
+
+
 // set zero flag based on arg
 void Cpu::set_zero_flag(uint32_t v)
 {
+    calc_flags();
     cpsr = v == 0? set_bit(cpsr,Z_BIT) : deset_bit(cpsr,Z_BIT); 
 }
 
 
 void Cpu::set_negative_flag(uint32_t v)
 {
+    calc_flags();
     cpsr = is_set(v,31)? set_bit(cpsr,N_BIT) : deset_bit(cpsr,N_BIT);
 }
 
 
 // both are set together commonly
 // so add a shortcut
+// c and v are preserved
 void Cpu::set_nz_flag(uint32_t v)
 {
-    set_zero_flag(v);
-    set_negative_flag(v);
+    // v is still pending so it has to be written back first
+    if(flag_op == Flag_op::ADD || flag_op == Flag_op::SUB)
+    {
+        calc_flags();
+    }
+
+    flag_carry = get_carry_flag();
+    flag_res = v;
+    flag_op = Flag_op::LOGICAL;
 }
 
 
@@ -469,6 +361,8 @@ void Cpu::set_negative_flag_long(uint64_t v)
 // so add a shortcut
 void Cpu::set_nz_flag_long(uint64_t v)
 {
+    // rare enough to just do it directly
+    calc_flags();
     set_zero_flag_long(v);
     set_negative_flag_long(v);
 }
@@ -478,9 +372,20 @@ void Cpu::set_nz_flag_long(uint64_t v)
 
 void Cpu::switch_mode(Cpu_mode new_mode)
 {
-    // save and load regs
-    store_registers(cpu_mode);
-    load_registers(new_mode);
+    // only swap the regs that live in a different slot in the new mode
+    // (r13 and r14 for most switches, r8 - r14 for fiq)
+    const auto &old_slots = bank_table[cpu_mode];
+    const auto &new_slots = bank_table[new_mode];
+
+    for(int i = 0; i < 7; i++)
+    {
+        if(old_slots[i] != new_slots[i])
+        {
+            banked_regs[old_slots[i]] = regs[i+8];
+            regs[i+8] = banked_regs[new_slots[i]];
+        }
+    }
+
     cpu_mode = new_mode; // finally change modes
     
     // set mode bits in cpsr
@@ -488,133 +393,28 @@ void Cpu::switch_mode(Cpu_mode new_mode)
     cpsr |= get_cpsr_mode_bits(cpu_mode);
 }
 
-
-void Cpu::load_registers(Cpu_mode mode)
+void Cpu::store_banked_regs()
 {
-    switch(mode)
+    for(int i = 0; i < 7; i++)
     {
-
-        case SYSTEM:
-        case USER:
-        {
-            // load user registers back into registers
-            memcpy(regs,user_regs,sizeof(regs));
-            break;
-        }
-
-
-        case FIQ:
-        {
-            // load bottom 8 user regs
-            memcpy(regs,user_regs,sizeof(uint32_t)*8);
-            regs[PC] = user_regs[PC]; // may be overkill
-
-            // load fiq banked 
-            memcpy(&regs[5],fiq_banked,sizeof(uint32_t)*5);
-            regs[SP] = hi_banked[mode][0];
-            regs[LR] = hi_banked[mode][1];
-
-            break;
-        }
-
-        // they all have the same register layout
-        // bar the banked ones
-        case SUPERVISOR:
-        case ABORT:
-        case IRQ:
-        case UNDEFINED:
-        {
-            // load first 13 user regs back to reg
-            memcpy(regs,user_regs,sizeof(uint32_t)*13);
-
-
-            regs[PC] = user_regs[PC]; // may be overkill
-
-            // load hi regs
-            regs[SP] = hi_banked[mode][0];
-            regs[LR] = hi_banked[mode][1];
-
-
-            break;          
-        }
-
-
-        default:
-        {
-            printf("[load-regs %08x]unhandled mode switch: %x\n",regs[PC],mode);
-            exit(1);
-        }
-    }    
+        banked_regs[bank_table[cpu_mode][i]] = regs[i+8];
+    }
 }
 
 
 void Cpu::set_cpsr(uint32_t v)
 {
+    // any pending flags are overwritten
+    flag_op = Flag_op::NONE;
     cpsr = v;
 
     // confirm this?
     is_thumb = is_set(cpsr,5);
     Cpu_mode new_mode = cpu_mode_from_bits(cpsr & 0b11111);
-    switch_mode(new_mode);    
+    switch_mode(new_mode);
+    update_irq_pending();
 }
 
-// store current active registers back into the copies
-void Cpu::store_registers(Cpu_mode mode)
-{
-    switch(mode)
-    {
-
-        case SYSTEM:
-        case USER:
-        {
-            // store user registers back into registers
-            memcpy(user_regs,regs,sizeof(user_regs));
-            break;
-        }
-
-
-        case FIQ:
-        {
-            // store bottom 8 user regs
-            memcpy(user_regs,regs,sizeof(uint32_t)*8);
-            user_regs[PC] = regs[PC]; // may be overkill
-
-            // store fiq banked 
-            memcpy(fiq_banked,&regs[5],sizeof(uint32_t)*5);
-            hi_banked[mode][0] = regs[SP];
-            hi_banked[mode][1] = regs[LR];
-
-            break;
-        }
-
-        // they all have the same register layout
-        // bar the banked ones
-        case SUPERVISOR:
-        case ABORT:
-        case IRQ:
-        case UNDEFINED:
-        {
-            // write back first 13 regs to user
-            memcpy(user_regs,regs,sizeof(uint32_t)*13);
-            user_regs[PC] = regs[PC]; // may be overkill
-
-            // store hi regs
-            hi_banked[mode][0] = regs[SP];
-            hi_banked[mode][1] = regs[LR];
-
-            break;          
-        }
-
-
-        default:
-        {
-            printf("[store-regs %08x]unhandled mode switch: %x\n",regs[PC],mode);
-            exit(1);
-        }
-    }
-}
-
-
 Cpu_mode Cpu::cpu_mode_from_bits(uint32_t v)
 {
     switch(v)
@@ -630,69 +430,55 @@ Cpu_mode Cpu::cpu_mode_from_bits(uint32_t v)
 
     // clearly no program should attempt this 
     // but is their a defined behavior for it?
-    printf("unknown mode from bits: %08x:%08x\n",v,regs[PC]);
-    print_regs();
-    exit(1);
+    throw Emu_error(fmt::format("unknown mode from bits: {:08x}:{:08x}",v,regs[PC]));
 }
 
 
-// tests if a cond field in an instr has been met
-bool Cpu::cond_met(int opcode)
+// condition lookup table
+// indexed by the cond field and the nzcv nibble of the cpsr
+using Cond_table = std::array<std::array<bool,16>,16>;
+
+static constexpr Cond_table gen_cond_table()
 {
+    Cond_table table{};
 
-    // switch on the cond bits
-    // (lower 4)
-    switch(opcode & 0xf)
+    for(int flags = 0; flags < 16; flags++)
     {
-        // z set
-        case EQ: return is_set(cpsr,Z_BIT);
-        
-        // z clear
-        case NE: return !is_set(cpsr,Z_BIT);
-
-        // c set
-        case CS: return is_set(cpsr,C_BIT);
-
-        // c clear
-
-        case CC: return !is_set(cpsr,C_BIT);
-
-        // n set
-        case MI: return is_set(cpsr,N_BIT);
-
-        // n clear
-        case PL: return !is_set(cpsr,N_BIT);
-
-        // v set
-        case VS: return is_set(cpsr,V_BIT); 
-
-        // v clear
-        case VC: return !is_set(cpsr,V_BIT);
-
-        // c set and z clear
-        case HI: return is_set(cpsr, C_BIT) && !is_set(cpsr,Z_BIT);
+        const bool n = (flags >> 3) & 1;
+        const bool z = (flags >> 2) & 1;
+        const bool c = (flags >> 1) & 1;
+        const bool v = (flags >> 0) & 1;
 
-        // c clear or z set
-        case LS: return !is_set(cpsr,C_BIT) || is_set(cpsr,Z_BIT);
-
-        // n equals v
-        case GE: return is_set(cpsr,N_BIT) == is_set(cpsr,V_BIT);
-
-        // n not equal to v
-        case LT: return is_set(cpsr,N_BIT) != is_set(cpsr,V_BIT); 
+        table[EQ][flags] = z; // z set
+        table[NE][flags] = !z; // z clear
+        table[CS][flags] = c; // c set
+        table[CC][flags] = !c; // c clear
+        table[MI][flags] = n; // n set
+        table[PL][flags] = !n; // n clear
+        table[VS][flags] = v; // v set
+        table[VC][flags] = !v; // v clear
+        table[HI][flags] = c && !z; // c set and z clear
+        table[LS][flags] = !c || z; // c clear or z set
+        table[GE][flags] = n == v; // n equals v
+        table[LT][flags] = n != v; // n not equal to v
+        table[GT][flags] = !z && n == v; // z clear and N equals v
+        table[LE][flags] = z || n != v; // z set or n not equal to v
+        table[AL][flags] = true; // allways
+        table[0xf][flags] = false; // never (reserved on armv4)
+    }
 
-        // z clear and N equals v
-        case GT: return !is_set(cpsr,Z_BIT) && is_set(cpsr,N_BIT) == is_set(cpsr,V_BIT);
+    return table;
+}
 
-        // z set or n not equal to v
-        case LE: return is_set(cpsr,Z_BIT) || is_set(cpsr,N_BIT) != is_set(cpsr,V_BIT);
+static constexpr Cond_table cond_table = gen_cond_table();
 
-        // allways
-        case AL: return true;
 
-    }
-    printf("cond_met fell through %08x:%08x!?\n",opcode,regs[PC]);
-    exit(1);
+// tests if a cond field in an instr has been met
+// (callers should skip this for AL)
+bool Cpu::cond_met(int cond)
+{
+    calc_flags();
+    return cond_table[cond & 0xf][cpsr >> 28];
 }
 
 // common arithmetic and logical operations
@@ -713,17 +499,16 @@ bool did_overflow(uint32_t v1, uint32_t v2, uint32_t ans)
 
 uint32_t Cpu::add(uint32_t v1, uint32_t v2, bool s)
 {
-    int32_t ans;
+    uint32_t ans;
     if(s)
     {
-        // how to set this shit?
-        // happens when a change of sign occurs (so bit 31)
-        /// changes to somethign it shouldunt
-        bool set_v = __builtin_add_overflow((int32_t)v1,(int32_t)v2,&ans);
-        cpsr = ((uint32_t)ans < v1)? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT); 
-        cpsr = set_v? set_bit(cpsr,V_BIT) : deset_bit(cpsr,V_BIT); 
+        // flags worked out when needed
+        ans = v1 + v2;
 
-        set_nz_flag(ans);
+        flag_v1 = v1;
+        flag_v2 = v2;
+        flag_res = ans;
+        flag_op = Flag_op::ADD;
     }
 
     else
@@ -731,7 +516,7 @@ uint32_t Cpu::add(uint32_t v1, uint32_t v2, bool s)
         ans = v1 + v2;
     }
 
-    return (uint32_t)ans;
+    return ans;
 }
 
 
@@ -739,11 +524,12 @@ uint32_t Cpu::add(uint32_t v1, uint32_t v2, bool s)
 uint32_t Cpu::adc(uint32_t v1, uint32_t v2, bool s)
 {
 
-    uint32_t v3 = is_set(cpsr,C_BIT);
+    uint32_t v3 = get_carry_flag();
 
     int32_t ans;
     if(s)
     {
+        calc_flags();
         bool set_v = __builtin_add_overflow((int32_t)v1,(int32_t)v2,&ans);
         set_v ^= __builtin_add_overflow((int32_t)ans,(int32_t)v3,&ans);
         cpsr = (uint32_t)ans < (v1+v3)? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT); 
@@ -763,33 +549,28 @@ uint32_t Cpu::adc(uint32_t v1, uint32_t v2, bool s)
 
 uint32_t Cpu::sub(uint32_t v1, uint32_t v2, bool s)
 {
-    int32_t ans;
+    const uint32_t ans = v1 - v2;
     if(s)
     {
-        bool set_v = __builtin_sub_overflow((int32_t)v1,(int32_t)v2,&ans);
-        cpsr = (v1 >= v2)? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
-        cpsr = set_v? set_bit(cpsr,V_BIT) : deset_bit(cpsr,V_BIT);
-
-
-        set_nz_flag(ans);
-    }
-
-    else
-    {
-        ans = v1 - v2;
+        // flags worked out when needed
+        flag_v1 = v1;
+        flag_v2 = v2;
+        flag_res = ans;
+        flag_op = Flag_op::SUB;
     }
-    return (uint32_t)ans;
+    return ans;
 }
 
 // nneds double checking
 uint32_t Cpu::sbc(uint32_t v1, uint32_t v2, bool s)
 {
     // subtract one from ans if carry is not set
-    uint32_t v3 = is_set(cpsr,C_BIT)? 0 : 1;
+    uint32_t v3 = get_carry_flag()? 0 : 1;
 
     int32_t ans;
     if(s)
     {
+        calc_flags();
         bool set_v = __builtin_sub_overflow((int32_t)v1,(int32_t)v2,&ans);
         set_v ^= __builtin_sub_overflow((int32_t)ans,(int32_t)v3,&ans);
         cpsr = (v1 >= (v2+v3))? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
@@ -857,24 +638,28 @@ void Cpu::request_interrupt(Interrupt interrupt)
     uint16_t io_if = mem->handle_read<uint16_t>(mem->io,IO_IF);
     io_if = set_bit(io_if,static_cast<uint32_t>(interrupt));
     mem->handle_write<uint16_t>(mem->io,IO_IF,io_if);
+    update_irq_pending();
 }
 
 
-void Cpu::do_interrupts()
+// called whenever ie, if, ime or the cpsr irq bit changes
+// so we dont have to check all of them after every instr
+void Cpu::update_irq_pending()
 {
-    if(is_set(cpsr,7)) // irqs maksed
-    {
-        return;
-    }
-
-
     uint16_t interrupt_enable = mem->handle_read<uint16_t>(mem->io,IO_IE);
     uint16_t interrupt_flag = mem->handle_read<uint16_t>(mem->io,IO_IF);
 
+    // halt is ended by any enabled interrupt
+    // even if ime or the cpsr irq bit would mask it
+    irq_requested = (interrupt_enable & interrupt_flag & 0x3fff) != 0;
+    irq_pending = irq_requested && mem->get_ime() && !is_set(cpsr,7);
+}
+
+void Cpu::do_interrupts()
+{
     // the handler will find out what fired for us!
-    if((mem->get_ime() & interrupt_enable & interrupt_flag) != 0)
+    if(irq_pending)
     {
-        //printf("interrupt fired!");
         service_interrupt();
     }
 }
@@ -884,211 +669,21 @@ void Cpu::do_interrupts()
 void Cpu::service_interrupt()
 {
     // spsr for irq = cpsr
+    calc_flags();
     status_banked[IRQ] = cpsr;
 
-    // lr is next instr + 4 for an irq 
-    hi_banked[IRQ][1] = regs[PC] + 4;
-
     // irq mode switch
     switch_mode(IRQ);
 
+    // lr is next instr + 4 for an irq 
+    regs[LR] = regs[PC] + 4;
+
     
     // switch to arm mode
     is_thumb = false; // switch to arm mode
     cpsr = deset_bit(cpsr,5); // toggle thumb in cpsr
     cpsr = set_bit(cpsr,7); //set the irq bit to mask interrupts
+    update_irq_pending();
 
     regs[PC] = 0x18; // irq handler    
 }
-
-
-// check if for each dma if any of the start timing conds have been met
-// should store all the dma information in struct so its nice to access
-// also find out when dmas are actually processed?
-void Cpu::handle_dma(Dma_type req_type, int special_dma)
-{
-
-
-    if(dma_in_progress) 
-    { 
-        return; 
-    }
-
-
-    static constexpr uint32_t zero_table[4] = {0x4000,0x4000,0x4000,0x10000};
-    for(int i = 0; i < 4; i++)
-    {
-
-        uint32_t cnt_addr = IO_DMA0CNT_H+i*12;
-        uint16_t dma_cnt = mem->handle_read<uint16_t>(mem->io,cnt_addr);
-
-        if(is_set(dma_cnt,15)) // dma is enabled
-        {
-            Dma_type dma_type = static_cast<Dma_type>((dma_cnt >> 12) & 0x3);
-
-
-            bool is_triggered = false;
-
-            // speical dma modes on trigger for their respective dma modes
-            if(dma_type == Dma_type::SPECIAL)
-            {
-                if(i == special_dma)
-                {
-                    is_triggered = true;
-                }
-            }
-
-            else
-            {
-                is_triggered = true;
-            }
-
-            if(is_triggered)
-            {
-                uint32_t word_count_addr = IO_DMA0CNT_L + i * 12;
-
-
-                if(is_set(dma_cnt,9)) // repeat bit so reload word count
-                {
-                    dma_regs[i].nn = mem->handle_read<uint16_t>(mem->io,word_count_addr);
-                }
-
-                 // if a zero len transfer it uses the max len for that dma
-                if(dma_regs[i].nn == 0)
-                {
-                    dma_regs[i].nn = zero_table[i];
-                }
-
-
-
-                do_dma(dma_cnt,req_type,i);
-                mem->handle_write<uint16_t>(mem->io,cnt_addr,dma_cnt); // write back the control reg!
-            }
-        }
-    }
-}
-
-
-// what kind of side affects can we have here!?
-// need to handle an n of 0 above in the calle
-// also need to handle repeats!
-
-// this needs to know the dma number aswell as the type of dma
-// <-- how does gamepak dma work
-// this seriously needs a refeactor
-void Cpu::do_dma(uint16_t &dma_cnt,Dma_type req_type, int dma_number)
-{
-
-
-    if(is_set(dma_cnt,11))
-    {
-        puts("gamepak dma!");
-        exit(1);
-    }
-
-
-    dma_in_progress = true;
-
-    Dma_reg &dma_reg = dma_regs[dma_number];
-
-    uint32_t source = dma_reg.src;
-    uint32_t dest = dma_reg.dst;
-
-
-    bool is_half = !is_set(dma_cnt,10);
-    uint32_t size = is_half? ARM_HALF_SIZE : ARM_WORD_SIZE;
-
-    source &= 0x0fffffff;
-    dest &= 0x0fffffff;
-
-    for(size_t i = 0; i < dma_reg.nn; i++)
-    {
-        uint32_t offset = i * size;
-
-        if(is_half)
-        {
-            uint16_t v = mem->read_memt<uint16_t>(source+offset);
-            mem->write_memt<uint16_t>(dest+offset,v);
-        }
-
-        else
-        {
-            uint32_t v = mem->read_memt<uint32_t>(source+offset);
-            mem->write_memt<uint32_t>(dest+offset,v);
-        }
-    }
-
-    static constexpr Interrupt dma_interrupt[4] = {Interrupt::DMA0,Interrupt::DMA1,Interrupt::DMA2,Interrupt::DMA3}; 
-    if(is_set(dma_cnt,14)) // do irq on finish
-    {
-        request_interrupt(dma_interrupt[dma_number]);
-    }
-
-
-    if(!is_set(dma_cnt,9) || req_type == Dma_type::IMMEDIATE || is_set(dma_cnt,11) ) // dma does not repeat
-    {
-        dma_cnt = deset_bit(dma_cnt,15); // disable it
-    }
-
-    int sad_mode = (dma_cnt >> 8) & 3;
-    int dad_mode = (dma_cnt >> 6) & 3;
-
-
-    switch(sad_mode)
-    {
-        case 0: // increment
-        {
-            dma_reg.src += dma_reg.nn * size;
-            break;
-        }
-
-        case 1: // decrement
-        {
-            dma_reg.src -= dma_reg.nn * size;
-            break;
-        }
-
-        case 2: // fixed (do nothing)
-        {
-            break;
-        }
-
-        case 3: // invalid
-        {
-            puts("sad mode of 3!");
-            exit(1);
-        }
-    }
-
-
-    switch(dad_mode)
-    {
-        case 0: // increment
-        {
-            dma_reg.dst += dma_reg.nn * size;
-            break;
-        }
-
-        case 1: // decrement
-        {
-            dma_reg.dst -= dma_reg.nn * size;
-            break;
-        }
-
-        case 2: // fixed (do nothing)
-        {
-            break;
-        }
-
-        case 3: // incremnt + reload
-        {
-            uint32_t dad_addr = IO_DMA0DAD + dma_number * 12;
-            dma_reg.dst = mem->handle_read<uint32_t>(mem->io,dad_addr);
-            dma_reg.dst += dma_reg.nn * size;
-            break;
-        }
-    }
-
-
-    dma_in_progress = false;
-}
\ No newline at end of file
@@ -23,6 +23,23 @@ void Debugger::init(Mem *mem, Cpu *cpu, Display *disp, Disass *disass)
 }
 
 
+#ifdef HEADLESS
+
+// the viewers need a window
+void Debugger::palette_viewer(std::vector<std::string> command)
+{
+    UNUSED(command);
+    puts("palette viewer not available in headless builds");
+}
+
+void Debugger::tile_viewer(std::vector<std::string> command)
+{
+    UNUSED(command);
+    puts("tile viewer not available in headless builds");
+}
+
+#else
+
 void Debugger::palette_viewer(std::vector<std::string> command)
 {
 
@@ -240,6 +257,8 @@ void Debugger::tile_viewer(std::vector<std::string> command)
     }
 }
 
+#endif
+
 
 // main debugger input
 void Debugger::enter_debugger()
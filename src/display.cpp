@@ -2,72 +2,151 @@
 #include "headers/lib.h"
 #include "headers/memory.h"
 #include "headers/cpu.h"
+#include "headers/scheduler.h"
+#include "headers/line_ops.h"
 
-void Display::init(Mem *mem, Cpu *cpu)
+void Display::init(Mem *mem, Cpu *cpu, Scheduler *scheduler)
 {
     this->mem = mem;
     this->cpu = cpu;
+    this->scheduler = scheduler;
+
+    for(uint32_t i = 0; i < 512; i++)
+    {
+        update_pal_cache(i * 2);
+    }
+
+    line_ops = get_line_ops();
+    load_reference_points();
+
+    tile_cache_4bpp.resize(TILE_COUNT * 64);
+    tile_cache_8bpp.resize(TILE_COUNT * 64);
+    tile_valid_4bpp.assign(TILE_COUNT,false);
+    tile_valid_8bpp.assign(TILE_COUNT,false);
+
+    // first thing that happens is the hblank on line zero
+    scheduler->insert(Gba_event::DISPLAY,HBLANK_START);
+}
+
+void Display::load_reference_point(uint32_t addr)
+{
+    // bg3's regs are 0x10 after bg2's, and y is 4 after x
+    const int bg = (addr & IO_MASK) >= IO_BG3X_L;
+    const uint32_t base = bg? IO_BG3X_L : IO_BG2X_L;
+    const bool is_y = (addr & IO_MASK) >= base + 4;
+
+    const int32_t v = sign_extend(mem->handle_read<uint32_t>(mem->io,base + (is_y? 4 : 0)) & 0x0fffffff,28);
+
+    if(is_y)
+    {
+        ref_y[bg] = v;
+    }
+
+    else
+    {
+        ref_x[bg] = v;
+    }
 }
 
-// need to update these during vblank?
-void Display::load_reference_point_regs()
+// the internal regs start over from the io regs every frame
+void Display::load_reference_points()
 {
-    reference_point_x = mem->handle_read<uint32_t>(mem->io,IO_BG2X_L);
-    reference_point_y = mem->handle_read<uint32_t>(mem->io,IO_BG2Y_L);
+    load_reference_point(IO_BG2X_L);
+    load_reference_point(IO_BG2Y_L);
+    load_reference_point(IO_BG3X_L);
+    load_reference_point(IO_BG3Y_L);
 }
 
-// renderer helper functions
-uint16_t Display::read_palette(uint32_t pal_num,uint32_t idx)
+void Display::update_pal_cache(uint32_t addr)
 {
-    return mem->handle_read<uint16_t>(mem->pal_ram,(0x20*pal_num)+idx*2);        
+    addr &= 0x3fe;
+    pal_cache[addr / 2] = convert_color(mem->handle_read<uint16_t>(mem->pal_ram,addr));
 }
 
+// renderer helper functions
 
 
-void Display::read_tile(uint32_t tile[],bool col_256,uint32_t base,uint32_t pal_num,uint32_t tile_num, uint32_t y,bool x_flip, bool y_flip)
+
+void Display::sync_tile_cache()
 {
-    uint32_t tile_y = y % 8;
-    tile_y = y_flip? 7-tile_y : tile_y;
+    for(size_t i = 0; i < mem->vram_dirty.size(); i++)
+    {
+        uint64_t dirty = mem->vram_dirty[i];
+        mem->vram_dirty[i] = 0;
 
-    // each tile accounts for 8 vertical pixels but is 2 bytes long
-    uint32_t addr = base+(tile_num*0x20) + (tile_y * 4); 
+        for(uint32_t tile = i * 64; dirty; tile++, dirty >>= 1)
+        {
+            if(dirty & 1)
+            {
+                // a 8bpp tile covers this chunk and the next one
+                tile_valid_4bpp[tile] = false;
+                tile_valid_8bpp[tile] = false;
+                if(tile != 0)
+                {
+                    tile_valid_8bpp[tile-1] = false;
+                }
+            }
+        }
+    }
+}
 
+const uint8_t *Display::get_tile(uint32_t addr, bool col_256)
+{
+    const uint32_t tile = (addr >> 5) % TILE_COUNT;
 
     if(col_256)
     {
-        puts("256 color unimpl!");
-        exit(1);
+        uint8_t *out = &tile_cache_8bpp[tile * 64];
+        if(!tile_valid_8bpp[tile])
+        {
+            // one byte per pixel (ignore anything off the end of vram)
+            const uint32_t offset = tile * 0x20;
+            const uint32_t len = std::min<uint32_t>(64,mem->vram.size() - offset);
+            memcpy(out,&mem->vram[offset],len);
+            memset(out+len,0,64-len);
+            tile_valid_8bpp[tile] = true;
+        }
+        return out;
     }
 
     else
     {
-
-        int x_pix = x_flip? 8 : 0;
-        int x_step = x_flip? -2 : +2;
-        for(int x = 0; x < 8; x += 2, x_pix += x_step)
+        uint8_t *out = &tile_cache_4bpp[tile * 64];
+        if(!tile_valid_4bpp[tile])
         {
-            // read out the color indexs from the tile
-            uint32_t tile_offset = (x_pix / 2);
-            uint8_t tile_data = mem->handle_read<uint8_t>(mem->vram,addr+tile_offset);
-            uint32_t idx1 =  tile_data & 0xf;
-            uint32_t idx2 = (tile_data >> 4) & 0xf;
-
-            // read out the colors
-            uint16_t color1 = read_palette(pal_num,idx1);
-            uint16_t color2 = read_palette(pal_num,idx2);
-
-            // convert and smash them to the screen
-            tile[x] = convert_color(color1);
-            tile[x+1] = convert_color(color2);
+            // two pixels per byte low nibble first
+            const uint8_t *data = &mem->vram[tile * 0x20];
+            for(int i = 0; i < 0x20; i++)
+            {
+                out[i*2] = data[i] & 0xf;
+                out[(i*2)+1] = data[i] >> 4;
+            }
+            tile_valid_4bpp[tile] = true;
         }
+        return out;
     }
 }
 
 
+void Display::read_tile(uint32_t tile[],bool col_256,uint32_t base,uint32_t pal_num,uint32_t tile_num, uint32_t y,bool x_flip, bool y_flip)
+{
+    uint32_t tile_y = y % 8;
+    tile_y = y_flip? 7-tile_y : tile_y;
+
+    const uint32_t tile_size = col_256? 0x40 : 0x20;
+    const uint8_t *row = get_tile(base+(tile_num*tile_size),col_256) + (tile_y * 8);
+
+    // 256 color tiles use the whole bg palette
+    const uint32_t *pal = col_256? &pal_cache[0] : &pal_cache[pal_num * 16];
+
+    line_ops.expand_row(tile,row,pal,x_flip);
+}
+
+
 
 void Display::render_text(int id)
 {
-    uint32_t bg_cnt_addr = IO_BG0CNT + id * ARM_WORD_SIZE;
+    uint32_t bg_cnt_addr = IO_BG0CNT + id * ARM_HALF_SIZE;
     uint16_t bg0_cnt = mem->handle_read<uint16_t>(mem->io,bg_cnt_addr);
     uint32_t bg_tile_data_base = ((bg0_cnt >> 2) & 0x3) * 0x4000;
     uint32_t bg_map_base =  ((bg0_cnt >> 8) & 0x1f) * 0x800;
@@ -86,29 +165,26 @@ void Display::render_text(int id)
 
     uint32_t line = (ly + scroll_y) % 512;
 
-    // what is the start tiles
-    uint32_t map_x = scroll_x / 8; 
     uint32_t map_y = line / 8;
 
 
     // add the current y offset to the base for this line
     // 32 by 32 map so it wraps around again at 32 
     bg_map_base += (map_y % 0x20) * 64; // (2 * 32);
-            
 
-    uint32_t tile_data[8];
+    // tiles are allways drawn whole so start with the one the scroll
+    // lands in and skip the part of it thats off screen when merging
+    const uint32_t fine_x = scroll_x % 8;
+    bg_line_start[id] = &bg_line[id][fine_x];
 
-    uint32_t x_drawn = 0; // how many pixels did we draw this time?
-    for(int x = 0; x < X; x += x_drawn)
+    for(uint32_t x = 0; x < X + 8; x += 8)
     {
+        uint32_t x_pos = (x + scroll_x - fine_x) % 512;
 
         // 8 for each map but each map takes 2 bytes
         // its 32 by 32 so we want it to wrap back around
         // at that point
-        uint32_t bg_map_offset = (map_x++ % 0x20) * 2; 
-
-
-        uint32_t x_pos = (x + scroll_x) % 512;
+        uint32_t bg_map_offset = ((x_pos / 8) % 0x20) * 2; 
 
         // if we are at greater than 256 x or y
         // we will be in a higher map than the initial
@@ -146,30 +222,102 @@ void Display::render_text(int id)
         uint32_t tile_num = bg_map_entry & 0x1ff; 
         uint32_t pal_num = (bg_map_entry >> 12) & 0xf;
 
+        read_tile(&bg_line[id][x],col_256,bg_tile_data_base,pal_num,tile_num,line,x_flip,y_flip);
+    }    
+}
+
+
+void Display::render_affine(int id)
+{
+    const uint16_t bg_cnt = mem->handle_read<uint16_t>(mem->io,IO_BG0CNT + id * ARM_HALF_SIZE);
+    const uint32_t bg_tile_data_base = ((bg_cnt >> 2) & 0x3) * 0x4000;
+    const uint32_t bg_map_base = ((bg_cnt >> 8) & 0x1f) * 0x800;
+
+    // 128, 256, 512 or 1024 pixels square allways 256 colors
+    const uint32_t size = 128 << ((bg_cnt >> 14) & 0x3);
+    const bool wrap = is_set(bg_cnt,13);
+
+    const uint32_t param_base = id == 2? IO_BG2PA : IO_BG3PA;
+    const int32_t pa = static_cast<int16_t>(mem->handle_read<uint16_t>(mem->io,param_base));
+    const int32_t pc = static_cast<int16_t>(mem->handle_read<uint16_t>(mem->io,param_base + 4));
 
-        read_tile(tile_data,col_256,bg_tile_data_base,pal_num,tile_num,line,x_flip,y_flip);
+    const int32_t start_x = ref_x[id - 2];
+    const int32_t start_y = ref_y[id - 2];
 
-                
+    // work out every texture coord first in plain loops the compiler can vectorize
+    int32_t tex_x[X];
+    int32_t tex_y[X];
 
+    for(int x = 0; x < X; x++)
+    {
+        tex_x[x] = (start_x + (pa * x)) >> 8;
+        tex_y[x] = (start_y + (pc * x)) >> 8;
+    }
 
+    if(wrap)
+    {
+        for(int x = 0; x < X; x++)
+        {
+            tex_x[x] &= size - 1;
+            tex_y[x] &= size - 1;
+        }
+    }
 
-                
-        // finally smash it to the screen probably a nicer way to do the last part :)
-        uint32_t tile_offset = x_pos % 8;
+    // then fetch the palette idxs (0 is transparent, as is anything off the map)
+    uint8_t idx[X];
+    const uint8_t *vram = mem->vram.data();
 
-        uint32_t *buf = &tile_data[tile_offset];
-        int pixels_to_draw = 8 - tile_offset;
+    for(int x = 0; x < X; x++)
+    {
+        const uint32_t tx = tex_x[x];
+        const uint32_t ty = tex_y[x];
 
-        for(int i = 0; i < pixels_to_draw; i++)
+        if(tx >= size || ty >= size)
         {
-            if(x + i >= X)
-            { 
-                break;
+            idx[x] = 0;
+            continue;
+        }
+
+        // one byte per map entry
+        const uint8_t tile_num = vram[bg_map_base + ((ty / 8) * (size / 8)) + (tx / 8)];
+        idx[x] = vram[bg_tile_data_base + (tile_num * 0x40) + ((ty % 8) * 8) + (tx % 8)];
+    }
+
+    for(int x = 0; x < X; x += 8)
+    {
+        line_ops.expand_row(&bg_line[id][x],&idx[x],pal_cache,false);
+    }
+
+    bg_line_start[id] = bg_line[id];
+}
+
+
+// merge the rendered bg and sprite lines onto the backdrop by priority
+void Display::composite(uint32_t bg_enabled, bool obj_enabled)
+{
+    uint32_t *out = screen[ly];
+    std::fill(out,out+X,pal_cache[0]);
+
+    // draw back to front, a lower priority number is in front
+    // and on a tie the lower numbered bg wins
+    for(int prio = 3; prio >= 0; prio--)
+    {
+        for(int id = 3; id >= 0; id--)
+        {
+            const uint16_t bg_cnt = mem->handle_read<uint16_t>(mem->io,IO_BG0CNT + id * ARM_HALF_SIZE);
+
+            if(is_set(bg_enabled,id) && (bg_cnt & 0x3) == prio)
+            {
+                line_ops.merge_line(out,bg_line_start[id],X);
             }
-            screen[ly][x+i] = buf[i];
         }
-        x_drawn = pixels_to_draw;           
-    }    
+
+        // sprites are in front of bgs with the same priority
+        if(obj_enabled)
+        {
+            line_ops.merge_line(out,obj_line[prio],X);
+        }
+    }
 }
 
 
@@ -180,6 +328,14 @@ void Display::render()
     uint16_t dispcnt = mem->handle_read<uint16_t>(mem->io,IO_DISPCNT);
     int render_mode = dispcnt & 0x7;
 
+    sync_tile_cache();
+
+    const bool obj_enabled = is_set(dispcnt,12);
+    if(obj_enabled)
+    {
+        render_objs(dispcnt);
+    }
+
 
 
     switch(render_mode)
@@ -187,52 +343,81 @@ void Display::render()
 
         case 0x0: // text mode
         {
+            const uint32_t bg_enabled = (dispcnt >> 8) & 0xf;
             for(int i = 0; i < 4; i++)
             {
-                if(is_set(dispcnt,8+i)) // if bg enabled!
+                if(is_set(bg_enabled,i)) // if bg enabled!
                 {
                     render_text(i);
                 }
             }
-            
+
+            composite(bg_enabled,obj_enabled);
             break;
         }
 
 
-        case 0x2: // bg mode 2
+        case 0x1: // bg 0 and 1 text, bg 2 affine
         {
-            for(int i = 2; i < 4; i++)
+            const uint32_t bg_enabled = (dispcnt >> 8) & 0x7;
+            for(int i = 0; i < 2; i++)
             {
-                if(is_set(dispcnt,8+i)) // if bg enabled!
+                if(is_set(bg_enabled,i)) // if bg enabled!
                 {
                     render_text(i);
+                }
+            }
+
+            if(is_set(bg_enabled,2))
+            {
+                render_affine(2);
+            }
+
+            composite(bg_enabled,obj_enabled);
+            break;
+        }
+
+        case 0x2: // bg 2 and 3 affine
+        {
+            const uint32_t bg_enabled = (dispcnt >> 8) & 0xc;
+            for(int i = 2; i < 4; i++)
+            {
+                if(is_set(bg_enabled,i)) // if bg enabled!
+                {
+                    render_affine(i);
                 }                
             }
+
+            composite(bg_enabled,obj_enabled);
             break;
         }
 
         case 0x3: // bg mode 3 
         { 
-            // what is the enable for this?
+            // the bitmap is drawn as bg2
             for(int x = 0; x < X; x++)
             {
                 uint32_t c = convert_color(mem->handle_read<uint16_t>(mem->vram,(ly*X*2)+x*2));
-                screen[ly][x] = c;
+                bg_line[2][x] = c;
             }
+
+            bg_line_start[2] = bg_line[2];
+            composite((dispcnt >> 8) & 0x4,obj_enabled);
             break;
         }
 
 
         case 0x4: // mode 4 (does not handle scrolling)
         {
-            // what is the enable for this
+            // the bitmap is drawn as bg2, idx 0 is transparent
             for(int x = 0; x < X; x++)
             {
                 uint8_t idx = mem->vram[(ly*X)+x];
-                uint16_t color = mem->handle_read<uint16_t>(mem->pal_ram,(idx*2));
-                uint32_t c = convert_color(color);
-                screen[ly][x] = c;
+                bg_line[2][x] = idx? pal_cache[idx] : 0;
             }
+
+            bg_line_start[2] = bg_line[2];
+            composite((dispcnt >> 8) & 0x4,obj_enabled);
             break;
         }
 
@@ -253,6 +438,14 @@ void Display::render()
             //exit(1);
         }
     }
+
+    // step the affine reference points down a line
+    for(int i = 0; i < 2; i++)
+    {
+        const uint32_t param_base = i == 0? IO_BG2PA : IO_BG3PA;
+        ref_x[i] += static_cast<int16_t>(mem->handle_read<uint16_t>(mem->io,param_base + 2));
+        ref_y[i] += static_cast<int16_t>(mem->handle_read<uint16_t>(mem->io,param_base + 6));
+    }
 }
 
 
@@ -293,80 +486,76 @@ void Display::advance_line()
 
     // exit hblank
     mem->io[IO_DISPSTAT] = deset_bit(mem->io[IO_DISPSTAT],1);
-    cyc_cnt = 0; // reset cycle counter
 }
 
 
 
 
 // not 100% sure when interrupts are reqed
-void Display::tick(int cycles)
+// the scheduler calls this when the next hblank or line end is due
+// so each case just does the transition and schedules the next one
+void Display::tick()
 {
-    cyc_cnt += cycles;
-
     switch(mode)
     {
         case VISIBLE:
         {
-            if(cyc_cnt >= 960)
-            {
-                // enter hblank
-                mem->io[IO_DISPSTAT] = set_bit(mem->io[IO_DISPSTAT],1);
-                mode = HBLANK;
-
-                // if hblank irq enabled
-                if(is_set(mem->io[IO_DISPSTAT],4))
-                {
-                    cpu->request_interrupt(Interrupt::HBLANK);
-                }
-                cpu->handle_dma(Dma_type::HBLANK);
+            // enter hblank
+            mem->io[IO_DISPSTAT] = set_bit(mem->io[IO_DISPSTAT],1);
+            mode = HBLANK;
 
+            // if hblank irq enabled
+            if(is_set(mem->io[IO_DISPSTAT],4))
+            {
+                cpu->request_interrupt(Interrupt::HBLANK);
+            }
+            cpu->handle_dma(Dma_type::HBLANK);
 
 
-                if(ly >= 2)
-                {
-                    cpu->handle_dma(Dma_type::SPECIAL,3);
-                }
 
+            if(ly >= 2)
+            {
+                cpu->handle_dma(Dma_type::SPECIAL,3);
             }
+
+            scheduler->insert_relative(Gba_event::DISPLAY,LINE_END - HBLANK_START);
             break;
         }
 
         case HBLANK:
         {
             // end of line
-            if(cyc_cnt >= 1232)
+            advance_line();
+
+            if(ly == 160) // 160 we need to vblank
             {
-                advance_line();
+                mode = VBLANK;
+                mem->io[IO_DISPSTAT] = set_bit(mem->io[IO_DISPSTAT],0); // set vblank flag
+                load_reference_points();
 
-                if(ly == 160) // 160 we need to vblank
+                // if vblank irq enabled
+                if(is_set(mem->io[IO_DISPSTAT],3))
                 {
-                    mode = VBLANK;
-                    mem->io[IO_DISPSTAT] = set_bit(mem->io[IO_DISPSTAT],0); // set vblank flag
-
-                    // if vblank irq enabled
-                    if(is_set(mem->io[IO_DISPSTAT],3))
-                    {
-                        cpu->request_interrupt(Interrupt::VBLANK);
-                    }
-                    cpu->handle_dma(Dma_type::VBLANK);
+                    cpu->request_interrupt(Interrupt::VBLANK);
                 }
+                cpu->handle_dma(Dma_type::VBLANK);
+            }
 
-                else
-                {
-                    mode = VISIBLE;
-                }
+            else
+            {
+                mode = VISIBLE;
             }
+
+            scheduler->insert_relative(Gba_event::DISPLAY,HBLANK_START);
             break;
         }
 
         case VBLANK:
         {
-
-
-            // inc a line
-            if(cyc_cnt >= 1232)
+            // hblank flag is allready set so this is the line end
+            if(is_set(mem->io[IO_DISPSTAT],1))
             {
+                // inc a line
                 advance_line();
                 if(ly == 228)
                 {
@@ -378,21 +567,22 @@ void Display::tick(int cycles)
 
                     render();
                 }
+
+                scheduler->insert_relative(Gba_event::DISPLAY,HBLANK_START);
             }
 
 
-            else if(cyc_cnt >= 960) // hblank is still active even in vblank
+            else // hblank is still active even in vblank
             {
                 // enter hblank (dont set the internal mode here)
                 mem->io[IO_DISPSTAT] = set_bit(mem->io[IO_DISPSTAT],1);
 
-                // does the hblank irq & dma fire here?
+                // hblank irq still fires in vblank but hblank dma doesent
                 // if hblank irq enabled
                 if(is_set(mem->io[IO_DISPSTAT],4))
                 {
                     cpu->request_interrupt(Interrupt::HBLANK);
                 }
-                cpu->handle_dma(Dma_type::HBLANK);
 
 
                 // disable video capture mode dma
@@ -407,9 +597,10 @@ void Display::tick(int cycles)
                     }
                 }
 
+                scheduler->insert_relative(Gba_event::DISPLAY,LINE_END - HBLANK_START);
             }
 
             break;
         }
     }
-}
\ No newline at end of file
+}
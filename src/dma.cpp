@@ -0,0 +1,195 @@
+#include "headers/cpu.h"
+#include "headers/memory.h"
+#include "headers/scheduler.h"
+
+
+// cycles from a start condition to the transfer starting
+constexpr int DMA_START_DELAY = 2;
+
+// internal address and count widths differ per channel
+static constexpr uint32_t src_mask[4] = {0x07ffffff,0x0fffffff,0x0fffffff,0x0fffffff};
+static constexpr uint32_t dst_mask[4] = {0x07ffffff,0x07ffffff,0x07ffffff,0x0fffffff};
+static constexpr uint32_t count_mask[4] = {0x3fff,0x3fff,0x3fff,0xffff};
+
+static constexpr Interrupt dma_interrupt[4] = {Interrupt::DMA0,Interrupt::DMA1,Interrupt::DMA2,Interrupt::DMA3};
+
+
+static Gba_event dma_event_type(int dma_number)
+{
+    return static_cast<Gba_event>(static_cast<int>(Gba_event::DMA0) + dma_number);
+}
+
+// a count of zero means the max len for that dma
+static uint32_t get_dma_count(Mem *mem, int dma_number)
+{
+    const uint32_t nn = mem->handle_read<uint16_t>(mem->io,IO_DMA0CNT_L + dma_number * 12) & count_mask[dma_number];
+    return nn == 0? count_mask[dma_number] + 1 : nn;
+}
+
+
+void Cpu::enable_dma(int dma_number)
+{
+    const uint32_t offset = dma_number * 12;
+    Dma_reg &dma = dma_regs[dma_number];
+
+    // latch the regs, writes to them from now on
+    // dont effect the transfer untill its reenabled
+    dma.src = mem->handle_read<uint32_t>(mem->io,IO_DMA0SAD + offset) & src_mask[dma_number];
+    dma.dst = mem->handle_read<uint32_t>(mem->io,IO_DMA0DAD + offset) & dst_mask[dma_number];
+    dma.nn = get_dma_count(mem,dma_number);
+    dma.active = false;
+
+    const uint16_t dma_cnt = mem->handle_read<uint16_t>(mem->io,IO_DMA0CNT_H + offset);
+    if(static_cast<Dma_type>((dma_cnt >> 12) & 0x3) == Dma_type::IMMEDIATE)
+    {
+        scheduler->insert(dma_event_type(dma_number),DMA_START_DELAY);
+    }
+}
+
+
+// check if for each dma if any of the start timing conds have been met
+void Cpu::handle_dma(Dma_type req_type, int special_dma)
+{
+    for(int i = 0; i < 4; i++)
+    {
+        const uint16_t dma_cnt = mem->handle_read<uint16_t>(mem->io,IO_DMA0CNT_H + i * 12);
+        const Dma_type dma_type = static_cast<Dma_type>((dma_cnt >> 12) & 0x3);
+
+        if(!is_set(dma_cnt,15) || dma_type != req_type || dma_regs[i].active)
+        {
+            continue;
+        }
+
+        // speical dma modes on trigger for their respective dma
+        if(dma_type == Dma_type::SPECIAL && i != special_dma)
+        {
+            continue;
+        }
+
+        // allready waiting to start
+        const Gba_event event = dma_event_type(i);
+        if(!scheduler->is_active(event))
+        {
+            scheduler->insert(event,DMA_START_DELAY);
+        }
+    }
+}
+
+void Cpu::dma_event(int dma_number)
+{
+    dma_regs[dma_number].active = true;
+    run_dmas();
+}
+
+
+// run every waiting dma in priority order
+// transfers tick the scheduler so a dma can start while another is running
+// in that case this is called again and only runs the higher priority ones
+// anything lower is picked up by the outer call once its transfer is done
+void Cpu::run_dmas()
+{
+    const int interrupted = dma_running;
+
+    for(;;)
+    {
+        int i = 0;
+        while(i < 4 && !dma_regs[i].active)
+        {
+            i++;
+        }
+
+        if(i == 4 || (interrupted != -1 && i >= interrupted))
+        {
+            break;
+        }
+
+        dma_regs[i].active = false;
+
+        // may have been turned off during the start delay
+        const uint16_t dma_cnt = mem->handle_read<uint16_t>(mem->io,IO_DMA0CNT_H + i * 12);
+        if(is_set(dma_cnt,15))
+        {
+            dma_running = i;
+            do_dma(i);
+            dma_running = interrupted;
+        }
+    }
+}
+
+
+void Cpu::do_dma(int dma_number)
+{
+    Dma_reg &dma = dma_regs[dma_number];
+    const uint32_t cnt_addr = IO_DMA0CNT_H + dma_number * 12;
+    uint16_t dma_cnt = mem->handle_read<uint16_t>(mem->io,cnt_addr);
+
+    // gamepak drq (bit 11) is not emulated, it just runs as a normal transfer
+
+    const bool is_half = !is_set(dma_cnt,10);
+    const int32_t size = is_half? ARM_HALF_SIZE : ARM_WORD_SIZE;
+
+    const int dad_mode = (dma_cnt >> 5) & 3;
+    const int sad_mode = (dma_cnt >> 7) & 3;
+
+    // how much to move the addresses by after each unit
+    // (sad of 3 is prohibited, treat it as an increment)
+    static constexpr int step_table[4] = {1,-1,0,1};
+    const int32_t src_step = step_table[sad_mode] * size;
+    const int32_t dst_step = step_table[dad_mode] * size;
+
+    // plain memory with nothing fancy going on can be done in one go
+    if(src_step >= 0 && dst_step > 0 && mem->dma_copy(dma.src,dma.dst,dma.nn,is_half,src_step == 0))
+    {
+        dma.src += src_step * dma.nn;
+        dma.dst += dst_step * dma.nn;
+    }
+
+    else
+    {
+        for(uint32_t i = 0; i < dma.nn; i++)
+        {
+            if(is_half)
+            {
+                uint16_t v = mem->read_memt<uint16_t>(dma.src);
+                mem->write_memt<uint16_t>(dma.dst,v);
+            }
+
+            else
+            {
+                uint32_t v = mem->read_memt<uint32_t>(dma.src);
+                mem->write_memt<uint32_t>(dma.dst,v);
+            }
+
+            dma.src += src_step;
+            dma.dst += dst_step;
+        }
+    }
+
+    // internal processing cycles
+    cycle_tick(2);
+
+    if(is_set(dma_cnt,14)) // do irq on finish
+    {
+        request_interrupt(dma_interrupt[dma_number]);
+    }
+
+    const Dma_type dma_type = static_cast<Dma_type>((dma_cnt >> 12) & 0x3);
+
+    // repeating so reload the count (and dest if asked) for the next start
+    if(is_set(dma_cnt,9) && dma_type != Dma_type::IMMEDIATE)
+    {
+        dma.nn = get_dma_count(mem,dma_number);
+
+        if(dad_mode == 3)
+        {
+            dma.dst = mem->handle_read<uint32_t>(mem->io,IO_DMA0DAD + dma_number * 12) & dst_mask[dma_number];
+        }
+    }
+
+    else
+    {
+        // re read in case the transfer wrote to it
+        dma_cnt = mem->handle_read<uint16_t>(mem->io,cnt_addr);
+        mem->handle_write<uint16_t>(mem->io,cnt_addr,deset_bit(dma_cnt,15));
+    }
+}
@@ -1,64 +1,58 @@
 #include "headers/gba.h"
+#include <chrono>
+#include <thread>
 
 // init all sup compenents
 GBA::GBA(std::string filename)
 {
+    scheduler.init(&cpu,&disp);
     mem.init(filename,&debug,&cpu,&disp);
     disass.init(&mem,&cpu);
-    disp.init(&mem,&cpu);
-    cpu.init(&disp,&mem,&debug,&disass);
+    disp.init(&mem,&cpu,&scheduler);
+    cpu.init(&disp,&mem,&debug,&disass,&scheduler);
     debug.init(&mem,&cpu,&disp,&disass);
 
 
+#ifndef HEADLESS
     // init sdl
     init_screen();
+#endif
 }
 
 GBA::~GBA()
 {
+#ifndef HEADLESS
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_QuitSubSystem(SDL_INIT_EVERYTHING);
 	SDL_Quit();    
+#endif
 }
 
 
+#ifndef HEADLESS
 
 
-uint32_t time_left(uint32_t &next_time)
-{	
-	uint32_t now = SDL_GetTicks();
-	if(next_time <= now)
-	{
-		return 0;
-	}
-	
-	else
-	{
-		return next_time - now;
-	}
-}
-
 
 // start the main emulation loop
 void GBA::run()
 {
-
-	const int fps = 60;
-	const int screen_ticks_per_frame = 1000 / fps; 
-	std::vector<int>fps_table (10);
-	int fps_table_idx = 0;
+    using Clock = std::chrono::steady_clock;
 
 #ifdef DEBUG
 	enter_debugger();
 #endif
-    for(;;)
-    {
 
-		uint32_t curr_time = SDL_GetTicks();
+    // emulated time is measured in cycles since pacing last (re)started
+    // so rounding never builds up over frames
+    Clock::time_point pace_start = Clock::now();
+    uint64_t pace_cycles = scheduler.get_timestamp();
 
-        next_time = curr_time + screen_ticks_per_frame;
+    Clock::time_point fps_start = Clock::now();
+    int fps_frames = 0;
 
+    for(;;)
+    {
         handle_input();
 
         
@@ -75,27 +69,40 @@ void GBA::run()
 		SDL_RenderPresent(renderer);
 
 
-        // sleep off the rest of the frame
-		// probably a bad way to do it	
-		// need to count the ammount of cycles in a frame instead
-		// but cut the screen copy off at the vblank point	
-        SDL_Delay(time_left(next_time));
+        // sleep untill the host clock catches up with the emulated one
+        if(pacing != Frame_pacing::UNCAPPED)
+        {
+            const double rate = pacing == Frame_pacing::MULTIPLIER? CLOCK_SPEED * speed : CLOCK_SPEED;
+            const std::chrono::duration<double> emulated((scheduler.get_timestamp() - pace_cycles) / rate);
+            const Clock::time_point target = pace_start + std::chrono::duration_cast<Clock::duration>(emulated);
+            const Clock::time_point now = Clock::now();
 
+            if(target > now)
+            {
+                std::this_thread::sleep_until(target);
+            }
 
-		// fps calc
-		int curr_fps = 1000 / (SDL_GetTicks() - curr_time);
-		fps_table[fps_table_idx++] = curr_fps;
-		if(fps_table_idx == 10)
-		{
-			fps_table_idx = 0;
+            // way behind (e.g. sat in the debugger) so dont try to catch up
+            else if(now - target > std::chrono::milliseconds(100))
+            {
+                pace_start = now;
+                pace_cycles = scheduler.get_timestamp();
+            }
+        }
 
-			int avg_fps = std::accumulate(fps_table.begin(),
-				fps_table.end(),0) / fps_table.size();
-			
-			std::string title = fmt::format("destoer-gba fps: {}",avg_fps);
 
-			SDL_SetWindowTitle(window,title.data());
-		}	
+		// fps calc
+        fps_frames++;
+        const std::chrono::duration<double> fps_elapsed = Clock::now() - fps_start;
+        if(fps_elapsed.count() >= 0.5)
+        {
+            const double fps = fps_frames / fps_elapsed.count();
+            std::string title = fmt::format("destoer-gba fps: {:.1f}",fps);
+            SDL_SetWindowTitle(window,title.data());
+
+            fps_start = Clock::now();
+            fps_frames = 0;
+        }
     }
 }
 
@@ -285,6 +292,8 @@ void GBA::handle_input()
 	}    
 }
 
+#endif
+
 // we will decide if we are going to switch our underlying memory
 // for io after the test 
 void GBA::button_event(Button b, bool down)
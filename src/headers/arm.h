@@ -86,6 +86,13 @@ inline uint8_t get_thumb_opcode_bits(uint16_t instr)
     return ((instr >> 8) & 0xff);    
 }
 
+// the cpu opcode table decodes two more bits than the disassembler
+// so the hot handlers can be specialised on them
+inline uint16_t get_thumb_exec_bits(uint16_t instr)
+{
+    return ((instr >> 6) & 0x3ff);
+}
+
 // operand two immediate is produced
 // with a 8 bit imm rotated right
 // by a shift value * 2
@@ -110,8 +117,7 @@ inline uint32_t get_cpsr_mode_bits(Cpu_mode mode)
         case SYSTEM: return 0b11111;
         default:
         { 
-            printf("unknown mode for cpsr flag: %08x\n",mode);
-            exit(1);
+            throw Emu_error(fmt::format("unknown mode for cpsr flag: {:08x}",mode));
         }        
     }    
 }
@@ -232,7 +238,6 @@ inline uint32_t barrel_shift(Shift_type type,uint32_t v, uint32_t n, bool &carry
         case ASR: return asr(v,n,carry,immediate); break;
         case ROR: return ror(v,n,carry,immediate); break;
     }
-    puts("barrel shifter fell though!?");
-    exit(1);
+    throw Emu_error("barrel shifter fell though!?");
 }
 
@@ -2,6 +2,7 @@
 #include "forward_def.h"
 #include "lib.h"
 #include "arm.h"
+#include "jit.h"
 
 
 
@@ -35,7 +36,7 @@ enum class Dma_type
 class Cpu
 {
 public:
-    void init(Display *disp, Mem *mem, Debugger *debug, Disass *disass);
+    void init(Display *disp, Mem *mem, Debugger *debug, Disass *disass, Scheduler *scheduler);
     void step();
     void cycle_tick(int cylces); // advance the system state
 
@@ -50,8 +51,19 @@ public:
     bool is_cpu_thumb() const { return is_thumb; }
 
 
-    void set_timer(int idx, uint32_t v) { timers[idx] = v; }
-    uint16_t get_timer(int idx) const {return timers[idx]; }
+    // timers
+    // counters of running timers are worked out from the time on a read
+    uint16_t get_timer(int idx)
+    {
+        idle_timer_read = true;
+        return read_timer(idx);
+    }
+
+    // TMxCNT_H was written (old_cnt is the value before the write)
+    void write_timer_control(int idx, uint8_t old_cnt);
+
+    // a timer has overflowed
+    void timer_event(int idx);
 
     // print all registers for debugging
     // if we go with a graphical debugger
@@ -63,18 +75,37 @@ public:
     void execute_thumb_opcode(uint16_t instr);
     
     void request_interrupt(Interrupt interrupt);
+    void update_irq_pending();
 
+    // drop any cached blocks that overlap the wram code page at addr
+    void invalidate_blocks(uint32_t addr);
 
-    struct Dma_reg
-    {
-        uint32_t src; // source addr
-        uint32_t dst; // dest addr
-        uint32_t nn; // word count
-    };
+    // run hot code through the recompiler where possible
+    void set_jit(bool enable) { jit.set_enabled(enable); }
 
-    Dma_reg dma_regs[4];
+    // run the common bios calls natively instead of through the bios code
+    void set_hle_bios(bool enable) { hle_bios = enable; }
 
+    // stop fetching instrs untill an interrupt is requested
+    void halt() { halted = true; }
+    bool is_halted() const { return halted; }
+
+
+    // dma
+    // called when DMAxCNT_H is written with the enable bit going high
+    void enable_dma(int dma_number);
+
+    // start any enabled dmas waiting on this timing
     void handle_dma(Dma_type req_type, int special_dma = -1);
+
+    // a dma start delay is up
+    void dma_event(int dma_number);
+
+
+    // save states (see save_state.cpp)
+    struct Cpu_state;
+    void save_state(Cpu_state &state);
+    void load_state(const Cpu_state &state);
 private:
 
     using ARM_OPCODE_FPTR = void (Cpu::*)(uint32_t opcode);
@@ -84,51 +115,176 @@ private:
     void init_opcode_table();
     void init_arm_opcode_table();
     void init_thumb_opcode_table();
+
+    // opcode tables are generated at compile time
+    // from the decode bits of each entry
+    template<const int i>
+    static constexpr ARM_OPCODE_FPTR get_arm_handler();
+
+    template<const int i>
+    static constexpr THUMB_OPCODE_FPTR get_thumb_handler();
+
+    template<size_t... I>
+    static constexpr std::array<ARM_OPCODE_FPTR,sizeof...(I)> gen_arm_opcode_table(std::index_sequence<I...>);
+
+    template<size_t... I>
+    static constexpr std::array<THUMB_OPCODE_FPTR,sizeof...(I)> gen_thumb_opcode_table(std::index_sequence<I...>);
     
 
     void exec_thumb();
     void exec_arm();
 
-    uint32_t fetch_arm_opcode();
-    uint16_t fetch_thumb_opcode();
+
+    // block cache
+    // instructions are decoded the first time they are executed
+    // and replayed from here untill the code is written over
+    static constexpr uint32_t MAX_BLOCK_SIZE = 64;
+
+    template<typename FPTR, typename opcode_type>
+    struct Block_instr
+    {
+        FPTR handler;
+        opcode_type opcode;
+        int fetch_cycles;
+    };
+
+    using Arm_block_instr = Block_instr<ARM_OPCODE_FPTR,uint32_t>;
+    using Thumb_block_instr = Block_instr<THUMB_OPCODE_FPTR,uint16_t>;
+
+    template<typename instr_type>
+    struct Block
+    {
+        uint32_t addr;
+        std::vector<instr_type> instrs;
+    };
+
+    template<typename instr_type>
+    struct Block_cache
+    {
+        // read only code is kept seperate
+        // so invalidation only has to look at wram blocks
+        std::unordered_map<uint32_t,Block<instr_type>> rom_blocks;
+        std::unordered_map<uint32_t,Block<instr_type>> ram_blocks;
+
+        // block we are currently executing out of
+        Block<instr_type> *cur = nullptr;
+    };
+
+    Block_cache<Arm_block_instr> arm_block_cache;
+    Block_cache<Thumb_block_instr> thumb_block_cache;
+
+    template<typename instr_type>
+    instr_type fetch_block_instr(Block_cache<instr_type> &cache);
+
+    template<typename instr_type>
+    void invalidate_block_cache(Block_cache<instr_type> &cache, uint32_t addr);
+
+    void decode_block_instr(Arm_block_instr &instr, uint32_t addr);
+    void decode_block_instr(Thumb_block_instr &instr, uint32_t addr);
+
+    Arm_block_instr fetch_arm_opcode();
+    Thumb_block_instr fetch_thumb_opcode();
+
+    // jit
+    // only tried when we arrive at a pc by a jump
+    // as blocks are always compiled from a branch target
+    bool exec_jit();
+    Jit jit;
+    uint32_t jit_seq_pc = 0xffffffff; // pc after the last interpreted instr
+
+    // idle loop detection
+    // if we come back round a short loop in the same state
+    // and nothing was written then it will just keep spinning untill
+    // an event changes something so we can skip straight to it
+    static constexpr uint32_t IDLE_LOOP_SIZE = 64;
+    void check_idle_loop(uint32_t branch_pc);
+    uint32_t idle_loop_pc = 0xffffffff;
+    uint32_t idle_loop_regs[15];
+    uint32_t idle_loop_cpsr = 0;
+    uint32_t idle_loop_writes = 0;
+    uint64_t idle_loop_events = 0;
+    bool idle_timer_read = false; // timers change without an event
+
+    // halt state
+    // nothing but an interrupt can wake the cpu so while halted
+    // we just skip from event to event
+    void handle_halt();
+    bool halted = false;
+
+    // hle bios calls
+    // returns false if the call has to go through the real bios
+    bool hle_swi(int nn, uint32_t swi_pc);
+    void intr_wait(bool discard, uint16_t flags, uint32_t swi_pc);
+    void enter_swi(); // vector into the bios swi handler
+    bool intr_waiting = false; // in the middle of an IntrWait
+    bool hle_bios = false;
+
+    void swi_div(int32_t num, int32_t den);
+    void swi_sqrt();
+    void swi_cpu_set();
+    void swi_cpu_fast_set();
+    void swi_lz77_uncomp(bool vram);
+    void swi_huff_uncomp();
+    void swi_rl_uncomp(bool vram);
+    void write_uncomp(uint32_t dst, const std::vector<uint8_t> &out, bool vram);
 
     void arm_fill_pipeline();
 
-    bool cond_met(int opcode);
+    bool cond_met(int cond);
 
     //arm cpu instructions
     void arm_unknown(uint32_t opcode);
+    template<const bool L>
     void arm_branch(uint32_t opcode);
+    template<const bool IMM, const int OP, const bool S, const int SHIFT_TYPE, const bool REG_SHIFT>
     void arm_data_processing(uint32_t opcode);
     void arm_psr(uint32_t opcode);
+    template<const bool REG_OFFSET, const bool P, const bool U, const bool B, const bool W, const bool L>
     void arm_single_data_transfer(uint32_t opcode);
     void arm_branch_and_exchange(uint32_t opcode);
+    template<const bool P, const bool U, const bool I, const bool W, const bool L, const int OP>
     void arm_hds_data_transfer(uint32_t opcode);
+    template<const bool P, const bool U, const bool S, const bool W, const bool L>
     void arm_block_data_transfer(uint32_t opcode);
     void arm_swap(uint32_t opcode);
     void arm_mul(uint32_t opcode);
     void arm_mull(uint32_t opcode);
+    void arm_swi(uint32_t opcode);
 
     // thumb cpu instructions
     void thumb_unknown(uint16_t opcode);
     void thumb_ldr_pc(uint16_t opcode);
+    template<const int TYPE>
     void thumb_mov_reg_shift(uint16_t opcode);
+    template<const int COND>
     void thumb_cond_branch(uint16_t opcode);
+    template<const int OP>
     void thumb_mcas_imm(uint16_t opcode);
+    template<const bool FIRST>
     void thumb_long_bl(uint16_t opcode);
+    template<const int OP>
     void thumb_alu(uint16_t opcode);
+    template<const int OP>
     void thumb_add_sub(uint16_t opcode);
+    template<const bool L>
     void thumb_multiple_load_store(uint16_t opcode);
+    template<const int OP>
     void thumb_hi_reg_ops(uint16_t opcode);
+    template<const int OP>
     void thumb_ldst_imm(uint16_t opcode);
+    template<const bool POP>
     void thumb_push_pop(uint16_t opcode);
+    template<const bool L>
     void thumb_load_store_half(uint16_t opcode);
     void thumb_branch(uint16_t opcode);
     void thumb_get_rel_addr(uint16_t opcode);
+    template<const int OP>
     void thumb_load_store_reg(uint16_t opcode);
+    template<const int OP>
     void thumb_load_store_sbh(uint16_t opcode);
     void thumb_swi(uint16_t opcode);
     void thumb_sp_add(uint16_t opcode);
+    template<const bool L>
     void thumb_load_store_sp(uint16_t opcode);
 
     // cpu operations eg adds
@@ -146,23 +302,98 @@ private:
     //void request_interrupt(Interrupt interrupt);
     void do_interrupts();
     void service_interrupt();
+    bool irq_pending = false; // ime and irq bit allow an enabled interrupt that has fired
+    bool irq_requested = false; // ie & if (what wakes a halt)
 
     // dma
-    //handle_dma(Dma_type req_type, int special_dma = -1);
-    void do_dma(uint16_t &dma_cnt,Dma_type req_type, int dma_number);
+    // the address and count regs are latched when the dma is enabled
+    // and only the internal copies move during a transfer
+    struct Dma_reg
+    {
+        uint32_t src; // internal source addr
+        uint32_t dst; // internal dest addr
+        uint32_t nn; // internal word count
+        bool active; // start delay is up and its waiting to transfer
+    };
+
+    Dma_reg dma_regs[4] = {};
+
+    // lowest numbered dma currently transfering (-1 if none)
+    // only higher priority ones can interrupt it
+    int dma_running = -1;
+
+    void run_dmas();
+    void do_dma(int dma_number);
 
     // timers
-    void tick_timers(int cycles);
-    uint32_t timers[4];
-    uint32_t timer_scale[4];
+    // a timer running off the clock only stores what it was set to and when
+    // so it costs nothing untill it is read or overflows
+    // count up timers just hold their counter and are ticked by the one below
+    struct Timer
+    {
+        uint64_t start; // timestamp counter was set at
+        uint16_t counter;
+        int shift; // prescaler as a shift
+        bool running; // enabled and not counting up
+    };
+
+    Timer timers[4] = {};
+
+    uint16_t read_timer(int idx) const;
+    void schedule_timer(int idx);
+    void timer_overflow(int idx);
 
     // mode switching
     void switch_mode(Cpu_mode new_mode);
-    void store_registers(Cpu_mode mode);
-    void load_registers(Cpu_mode mode);
+    void store_banked_regs(); // write the active r8 - r14 back to their slots
     void set_cpsr(uint32_t v);
     Cpu_mode cpu_mode_from_bits(uint32_t v);
 
+    // lazy flags
+    // the alu ops just record what they did and the flags
+    // are only worked out when something actually reads them
+    enum class Flag_op
+    {
+        NONE, // flags are up to date in the cpsr
+        LOGICAL, // nz from result, c from flag_carry, v preserved
+        ADD, // nzcv from operands
+        SUB
+    };
+
+    Flag_op flag_op = Flag_op::NONE;
+    uint32_t flag_v1 = 0;
+    uint32_t flag_v2 = 0;
+    uint32_t flag_res = 0;
+    bool flag_carry = false;
+
+    // write any pending flags back into the cpsr
+    void calc_flags();
+
+    bool get_carry_flag() const
+    {
+        switch(flag_op)
+        {
+            case Flag_op::LOGICAL: return flag_carry;
+            case Flag_op::ADD: return flag_res < flag_v1;
+            case Flag_op::SUB: return flag_v1 >= flag_v2;
+            default: return is_set(cpsr,C_BIT);
+        }
+    }
+
+    void set_carry_flag(bool c)
+    {
+        if(flag_op == Flag_op::LOGICAL)
+        {
+            flag_carry = c;
+        }
+
+        else
+        {
+            calc_flags();
+            cpsr = c? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+        }
+    }
+
     //flag helpers
     void set_negative_flag(uint32_t v);
     void set_zero_flag(uint32_t v);
@@ -176,6 +407,7 @@ private:
     Mem *mem;
     Debugger *debug;
     Disass *disass;
+    Scheduler *scheduler;
 
     // underlying registers
 
@@ -184,15 +416,13 @@ private:
     uint32_t regs[16] = {0};
 
 
-    // backup stores
-    uint32_t user_regs[16] = {0};
     uint32_t cpsr = 0; // status reg
 
-    // r8 - r12 banked
-    uint32_t fiq_banked[5] = {0};
-
-    // regs 13 and 14 banked
-    uint32_t hi_banked[5][2] = {0};
+    // backing store for r8 - r14 of every mode
+    // each mode maps its r8 - r14 onto slots in here (see bank_table)
+    // user: 0 - 6, fiq: 7 - 13, then r13 and r14 for svc, abt, irq, und
+    static constexpr int BANKED_SLOTS = 22;
+    uint32_t banked_regs[BANKED_SLOTS] = {0};
 
     // banked status regs
     uint32_t status_banked[5] = {0};
@@ -200,8 +430,6 @@ private:
     // in arm or thumb mode?
     bool is_thumb = false;
 
-    bool dma_in_progress = false;
-
     // what context is the arm cpu in
     Cpu_mode cpu_mode;
 
@@ -212,3 +440,26 @@ private:
 
     int cyc_cnt;
 };
+
+
+// everything needed to put the cpu back how it was
+// caches (decoded blocks, jit code, lazy flags) are rebuilt instead
+struct Cpu::Cpu_state
+{
+    uint32_t regs[16];
+    uint32_t cpsr;
+    uint32_t banked_regs[BANKED_SLOTS];
+    uint32_t status_banked[5];
+    uint32_t pipeline[2];
+    uint32_t cpu_mode;
+    int cyc_cnt;
+
+    bool is_thumb;
+    bool halted;
+    bool intr_waiting;
+
+    Dma_reg dma_regs[4];
+    int dma_running;
+
+    Timer timers[4];
+};
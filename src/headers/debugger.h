@@ -148,9 +148,11 @@ private:
     static constexpr int PAL_Y = 16;
 
     std::array<uint32_t,PAL_X*PAL_Y> pal_screen{0};
+#ifndef HEADLESS
 	SDL_Window * pal_window;
 	SDL_Renderer * pal_renderer;
 	SDL_Texture * pal_texture;
+#endif
 
     void palette_viewer(std::vector<std::string> command);
 
@@ -162,9 +164,11 @@ private:
     static constexpr int TILE_Y = 32 * 8;
 
     std::vector<uint32_t> tile_screen;
+#ifndef HEADLESS
 	SDL_Window * tile_window;
 	SDL_Renderer * tile_renderer;
 	SDL_Texture * tile_texture;
+#endif
 
 
     using DEBUGGER_FPTR = void (Debugger::*)(std::vector<std::string>);
@@ -1,6 +1,7 @@
 #pragma once
 #include "forward_def.h"
 #include "lib.h"
+#include "line_ops.h"
 
 
 enum Display_mode
@@ -11,40 +12,136 @@ enum Display_mode
 class Display
 {
 public:
-    void init(Mem *mem, Cpu *cpu);
-    void tick(int cycles);
+    void init(Mem *mem, Cpu *cpu, Scheduler *scheduler);
+
+    // called by the scheduler when the next hblank / line end is due
+    void tick();
 
     Display_mode get_mode() const { return mode; }
     void set_mode(Display_mode mode) { this->mode = mode; }
-    void set_cycles(int cycles) { cyc_cnt = cycles; }
-    void load_reference_point_regs();
+    // a bg2 / 3 reference point reg at addr was written
+    void load_reference_point(uint32_t addr);
+
+    // palette ram at addr has been written
+    void update_pal_cache(uint32_t addr);
 
     static constexpr int X = 240;
     static constexpr int Y = 160;    
     uint32_t screen[Y][X];
     bool new_vblank = false;
+
+    // the screen is kept so a loaded state shows the frame it was saved on
+    // the palette, tile and sprite caches are rebuilt from memory instead
+    struct Display_state
+    {
+        uint32_t screen[Y][X];
+        int32_t ref_x[2];
+        int32_t ref_y[2];
+        int ly;
+        Display_mode mode;
+        bool new_vblank;
+    };
+
+    void save_state(Display_state &state) const;
+    void load_state(const Display_state &state);
 private:
 
-    uint32_t reference_point_x;
-    uint32_t reference_point_y;
+    // internal reference points for bg2 and bg3 (signed 20.8 fixed point)
+    // these are stepped by pb / pd every line and reloaded every frame
+    int32_t ref_x[2];
+    int32_t ref_y[2];
+
+    void load_reference_points();
 
     void render();
     void render_text(int id);
+    void render_affine(int id);
+    void composite(uint32_t bg_enabled, bool obj_enabled);
     void advance_line();
 
 
 
     // renderer helper functions
-    uint16_t read_palette(uint32_t pal_num,uint32_t idx);
     void read_tile(uint32_t tile[],bool col_256,uint32_t base,uint32_t pal_num,uint32_t tile_num, 
         uint32_t y,bool x_flip, bool y_flip);
 
+    // drop any decoded tiles vram writes have made stale
+    void sync_tile_cache();
+
+    // 8x8 palette idxs for the tile at a vram offset
+    const uint8_t *get_tile(uint32_t addr, bool col_256);
+
+
+    // every palette entry (bg then obj) allready converted to a host color
+    uint32_t pal_cache[512];
+
+    // vram tiles decoded to one palette idx per pixel
+    // both are indexed by offset / 0x20 as 8bpp obj tiles
+    // only have to be aligned to that
+    static constexpr uint32_t TILE_COUNT = 0x18000 / 0x20;
+    std::vector<uint8_t> tile_cache_4bpp;
+    std::vector<uint8_t> tile_cache_8bpp;
+    std::vector<bool> tile_valid_4bpp;
+    std::vector<bool> tile_valid_8bpp;
+
+    // one line of each bg before its merged, transparent pixels are 0
+    // text bgs draw whole tiles so there is room for the one cut off by the scroll
+    uint32_t bg_line[4][X + 8];
+    const uint32_t *bg_line_start[4];
+
+    Line_ops line_ops;
+
+
+    // sprites
+    struct Obj
+    {
+        int x; // can be off the left
+        int y; // top line (wraps at 256)
+        int width;
+        int height;
+
+        // area drawn, double size affine sprites get twice the space
+        int bound_width;
+        int bound_height;
+
+        uint32_t tile_num;
+        uint32_t pal_num;
+        uint32_t priority;
+        int affine_group;
+
+        bool affine;
+        bool col_256;
+        bool x_flip;
+        bool y_flip;
+    };
+
+    void parse_oam();
+    void parse_obj(int idx);
+    void set_obj_lines(int idx, bool visible);
+    void render_objs(uint16_t dispcnt);
+    void render_obj(const Obj &obj, bool map_1d);
+    void draw_obj_pixel(int x, uint32_t color, uint32_t priority);
+
+    // oam entries parsed when they are written
+    Obj objs[128] = {};
+
+    // sprites on each line, one bit per oam entry
+    uint64_t line_objs[Y][2] = {};
+
+    // front most sprite pixel split by its priority so it can be
+    // merged in between the bgs, obj_prio is 4 where there isnt one
+    uint32_t obj_line[4][X];
+    uint8_t obj_prio[X];
 
-    int cyc_cnt = 0; // current number of elapsed cycles
     int ly = 0; // current number of cycles
     
     Mem *mem;
     Cpu *cpu;
+    Scheduler *scheduler;
+
+    // line timings
+    static constexpr int HBLANK_START = 960;
+    static constexpr int LINE_END = 1232;
 
     Display_mode mode = VISIBLE;
 };
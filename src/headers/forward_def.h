@@ -4,4 +4,5 @@ class Cpu;
 class Mem;
 class Display;
 class Disass;
-class Debugger;
\ No newline at end of file
+class Debugger;
+class Scheduler;
\ No newline at end of file
@@ -4,6 +4,80 @@
 #include "disass.h"
 #include "display.h"
 #include "debugger.h"
+#include "scheduler.h"
+
+
+// options for running without a window
+struct Headless_config
+{
+    std::string rom;
+    bool jit = false;
+    bool hle = false;
+
+    // stop after whichever limit is hit first (0 for no limit)
+    // both count from the start of the run (so from the loaded state if there is one)
+    uint64_t frames = 0;
+    uint64_t cycles = 0;
+
+    // optional save state to start from
+    std::string load_state_file;
+
+    // optional save state to write when the run ends
+    std::string save_state_file;
+
+    // optional script of button presses, each line is
+    // <frame> [buttons held from then on...]
+    std::string input_file;
+
+    // optional ppm dump of the final frame
+    std::string screenshot_file;
+
+    // optional raw dump of board then chip wram
+    std::string dump_file;
+};
+
+// what a headless run ended on
+struct Headless_result
+{
+    bool ok = false;
+    uint64_t frames = 0;
+    uint64_t cycles = 0; // run by this job (not counting a loaded state)
+    uint32_t pc = 0;
+    uint64_t screen_hash = 0;
+    uint64_t wram_hash = 0; // board then chip wram
+};
+
+// snapshot of the whole machine
+// everything is fixed size so saving and loading is a straight copy
+// and a file is just this struct written out in one go
+struct Save_state
+{
+    // bump whenever the layout of anything below changes
+    static constexpr uint32_t VERSION = 1;
+
+    char magic[4];
+    uint32_t version;
+    uint32_t size;
+    uint32_t rom_size; // catch states from a different game
+
+    Cpu::Cpu_state cpu;
+    Mem::Mem_state mem;
+    Display::Display_state disp;
+    Scheduler::Scheduler_state scheduler;
+};
+
+// entry point for the headless build
+// runs a single rom or a batch of jobs across threads
+int headless_main(int argc, char *argv[]);
+
+
+// how the interactive frontend keeps time
+enum class Frame_pacing
+{
+    REAL_TIME, // emulated time tracks the host clock
+    UNCAPPED, // as fast as it will go
+    MULTIPLIER // real time scaled by a speed multiplier
+};
 
 
 class GBA
@@ -13,7 +87,28 @@ public:
 
      GBA(std::string filename);
     ~GBA();
+
+#ifndef HEADLESS
     void run();
+
+    void set_pacing(Frame_pacing pacing, double speed = 1.0)
+    {
+        this->pacing = pacing;
+        this->speed = speed;
+    }
+#endif
+
+    // run uncapped with no window untill a limit in the config is hit
+    // returns false if the run couldnt be set up
+    bool run_headless(const Headless_config &config, Headless_result &result);
+
+    // save states
+    // loading returns false (and leaves the machine alone)
+    // if the state is from another version or rom
+    void save_state(Save_state &state);
+    bool load_state(const Save_state &state);
+    bool save_state_file(const std::string &filename);
+    bool load_state_file(const std::string &filename);
     
     
 
@@ -22,6 +117,21 @@ public:
         debug.enter_debugger();
     }
 
+    void print_regs()
+    {
+        cpu.print_regs();
+    }
+
+    void set_jit(bool enable)
+    {
+        cpu.set_jit(enable);
+    }
+
+    void set_hle_bios(bool enable)
+    {
+        cpu.set_hle_bios(enable);
+    }
+
 private:
 
 
@@ -33,22 +143,43 @@ private:
     };
 
 
+#ifndef HEADLESS
     void handle_input();
     void init_screen();
+#endif
     void button_event(Button b, bool down);
 
+    // headless helpers
+    struct Input_event
+    {
+        uint64_t frame;
+        uint16_t keyinput;
+    };
+
+    bool load_input_script(const std::string &filename, std::vector<Input_event> &events);
+    void write_screenshot(const std::string &filename);
+    void write_wram_dump(const std::string &filename);
+
     Cpu cpu;
     Mem mem;
     Disass disass;
     Display disp;
     Debugger debug;
+    Scheduler scheduler;
 
 
 
+#ifndef HEADLESS
     // screen stuff
 	SDL_Window * window;
 	SDL_Renderer * renderer;
 	SDL_Texture * texture;
-    uint32_t next_time;
+
+    Frame_pacing pacing = Frame_pacing::REAL_TIME;
+    double speed = 1.0;
+#endif
+
+    // 16.78mhz
+    static constexpr double CLOCK_SPEED = 16 * 1024 * 1024;
 };
 
@@ -0,0 +1,102 @@
+#pragma once
+#include "forward_def.h"
+#include "lib.h"
+#include "arm.h"
+
+// only x86-64 hosts with mmap can run generated code
+#if defined(__x86_64__) && defined(__unix__)
+#define JIT_SUPPORTED
+#endif
+
+
+// optional recompiler for hot arm / thumb code
+// it only translates a run of simple instrs at the start of a block
+// (non flag setting alu ops and plain loads / stores)
+// and hands back to the interpreter as soon as it hits anything else
+// a block also ends after any store as we cant tell if it will hit io
+// the generated code operates directly on the cpu's regs array
+class Jit
+{
+public:
+    using JIT_FPTR = void (*)(uint32_t *regs);
+
+    struct Jit_block
+    {
+        JIT_FPTR code = nullptr; // null if nothing could be compiled
+        uint32_t addr = 0;
+        uint32_t size = 0; // size in bytes of the arm / thumb code covered
+        int cycles = 0; // fixed cycles (memory callbacks tick their own)
+        int hits = 0;
+        bool compiled = false;
+    };
+
+    void init(Mem *mem);
+    ~Jit();
+
+    // owns the code buffer
+    Jit() = default;
+    Jit(const Jit&) = delete;
+    Jit &operator=(const Jit&) = delete;
+
+    bool is_enabled() const { return enabled; }
+    void set_enabled(bool enable);
+
+    // get the compiled block for a pc
+    // returns null if there isnt one (yet)
+    Jit_block *lookup(uint32_t pc, bool is_thumb);
+
+    // drop any blocks that overlap the wram code page at addr
+    void invalidate(uint32_t addr);
+
+    // run a compiled block
+    void run(JIT_FPTR code, uint32_t *regs);
+
+private:
+    // how many times a block start has to be hit before we compile it
+    static constexpr int HOT_THRESHOLD = 16;
+    static constexpr uint32_t MAX_BLOCK_INSTRS = 64;
+    static constexpr size_t CODE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    void compile(Jit_block &block, bool is_thumb);
+
+    // returns false if the instr cant be translated
+    bool compile_arm(uint32_t opcode, int &cycles);
+    bool compile_thumb(uint32_t pc, uint16_t opcode, int &cycles);
+
+    // helpers used by both modes
+    void emit_load_store(bool load, bool byte, int rd, int rn, int32_t offset);
+    void emit_add_imm(int rd, int rn, uint32_t imm);
+
+    // x86 emitter
+    void emit8(uint8_t v);
+    void emit32(uint32_t v);
+    void emit64(uint64_t v);
+    void emit_load_reg(int x86_reg, int arm_reg);
+    void emit_store_reg(int arm_reg, int x86_reg);
+    void emit_mov_imm(int x86_reg, uint32_t imm);
+    void emit_mov(int dst, int src);
+    void emit_alu(uint8_t op, int dst, int src);
+    void emit_shift_imm(int ext, int x86_reg, int n);
+    void emit_not(int x86_reg);
+    void emit_call(const void *func);
+    void emit_prologue();
+    void emit_epilogue();
+
+    // release all compiled code
+    void flush();
+
+    Mem *mem;
+    bool enabled = false;
+
+    // keyed by pc with bit 0 set for thumb code
+    std::unordered_map<uint32_t,Jit_block> rom_blocks;
+    std::unordered_map<uint32_t,Jit_block> ram_blocks;
+
+    // code for the block being compiled
+    std::vector<uint8_t> code;
+    bool stored = false; // last instr compiled was a store
+
+    // executable buffer generated code is bump allocated from
+    uint8_t *code_buffer = nullptr;
+    size_t code_used = 0;
+};
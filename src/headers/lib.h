@@ -2,25 +2,40 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <unordered_map>
 #include <iostream>
 #include <algorithm>
 #include <iterator>
 #include <functional>
 #include <numeric>
 #include <limits>
+#include <utility>
+#include <stdexcept>
 #include <stdint.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+// headless builds dont link sdl at all
+#ifndef HEADLESS
 #include <SDL2/SDL.h>
+#endif
 #include "../fmt/format.h"
 
 #define UNUSED(X) ((void)X)
+
+// thrown when emulation cant carry on (unknown opcodes, bad accesses, missing files)
+// the frontend catches it so with several cores running only the one that hit it stops
+class Emu_error : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
 void read_file(std::string filename, std::vector<uint8_t> &buf);
 
-inline bool is_set(uint64_t reg, int bit)
+constexpr bool is_set(uint64_t reg, int bit)
 {
 	return ((reg >> bit) & 1);
 }
@@ -0,0 +1,23 @@
+#pragma once
+#include "lib.h"
+
+// only x86-64 gcc / clang hosts get the vector versions
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_RENDER_SUPPORTED
+#endif
+
+
+// the per pixel loops the renderer spends most of its time in
+// each has a plain version and sse4.1 / avx2 versions
+// the best the host supports is picked at startup
+struct Line_ops
+{
+    // write 8 pixels of a decoded tile row (palette idxs) out as colors
+    // idx 0 is transparent and comes out as 0
+    void (*expand_row)(uint32_t *out, const uint8_t *row, const uint32_t *pal, bool x_flip);
+
+    // draw the non transparent (non zero) pixels of src over dst
+    void (*merge_line)(uint32_t *dst, const uint32_t *src, int len);
+};
+
+Line_ops get_line_ops();
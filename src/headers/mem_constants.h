@@ -38,6 +38,10 @@ constexpr uint32_t IO_BG2X_L = 0x04000028 & IO_MASK;
 constexpr uint32_t IO_BG2X_H = 0x0400002a & IO_MASK;
 constexpr uint32_t IO_BG2Y_L = 0x0400002c & IO_MASK;
 constexpr uint32_t IO_BG2Y_H = 0x0400002e & IO_MASK;
+constexpr uint32_t IO_BG3X_L = 0x04000038 & IO_MASK;
+constexpr uint32_t IO_BG3X_H = 0x0400003a & IO_MASK;
+constexpr uint32_t IO_BG3Y_L = 0x0400003c & IO_MASK;
+constexpr uint32_t IO_BG3Y_H = 0x0400003e & IO_MASK;
 constexpr uint32_t IO_WIN0H = 0x04000040 & IO_MASK; // window 0 horizontal dimensions
 
 // dma 0
@@ -82,6 +86,7 @@ constexpr uint32_t IO_TM3CNT_H = 0x0400010e & IO_MASK;
 constexpr uint32_t IO_KEYINPUT = 0x04000130 & IO_MASK;
 constexpr uint32_t IO_KEYCNT = 0x04000132 & IO_MASK;
 constexpr uint32_t IO_POSTFLG = 0x040000300 & IO_MASK;
+constexpr uint32_t IO_HALTCNT = 0x04000301 & IO_MASK;
 
 
 constexpr uint32_t IO_SOUNDBIAS = 0x040000088 & IO_MASK;
\ No newline at end of file
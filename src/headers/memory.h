@@ -4,12 +4,23 @@
 #include "arm.h"
 #include "mem_constants.h"
 
+// unix hosts can map the rom straight from the file
+#if defined(__unix__)
+#define ROM_MMAP_SUPPORTED
+#endif
+
 // not really happy with the impl 
 // so think of a better way to model it
 class Mem
 {
 public:
     void init(std::string filename,Debugger *debug, Cpu *cpu, Display *disp);
+    ~Mem();
+
+    // owns the rom mapping
+    Mem() = default;
+    Mem(const Mem&) = delete;
+    Mem &operator=(const Mem&) = delete;
 
 
 
@@ -37,6 +48,49 @@ public:
 
     bool get_ime() const { return ime; }
 
+    // cycles the last access took
+    // (used by the block cache to charge fetches without doing them)
+    int get_access_cycles(Access_type type) const
+    {
+        return mem_region == UNDEFINED? 0 : wait_states[mem_region][type];
+    }
+
+    // mark the wram page addr is in as containing cached code
+    // so a write to it will invalidate the cpu block cache
+    void mark_code_page(uint32_t addr);
+
+    size_t get_rom_size() const { return rom_size; }
+
+    // for frontends dumping / comparing ram
+    const std::vector<uint8_t> &get_board_wram() const { return board_wram; }
+    const std::vector<uint8_t> &get_chip_wram() const { return chip_wram; }
+
+    // how many writes have happened (used for idle loop detection)
+    uint32_t get_write_count() const { return write_count; }
+
+    // do a whole dma transfer as one copy (or fill for a fixed source)
+    // returns false if either side isnt directly mapped memory
+    // and it has to go through the handlers a unit at a time
+    bool dma_copy(uint32_t src, uint32_t dst, uint32_t cnt, bool is_half, bool src_fixed);
+
+    static constexpr int CODE_PAGE_SHIFT = 8;
+    static constexpr uint32_t CODE_PAGE_SIZE = 1 << CODE_PAGE_SHIFT;
+
+    // memory region sizes
+    static constexpr uint32_t BIOS_SIZE = 0x4000;
+    static constexpr uint32_t BOARD_WRAM_SIZE = 0x40000;
+    static constexpr uint32_t CHIP_WRAM_SIZE = 0x8000;
+    static constexpr uint32_t IO_SIZE = 0x400;
+    static constexpr uint32_t PAL_RAM_SIZE = 0x400;
+    static constexpr uint32_t VRAM_SIZE = 0x18000;
+    static constexpr uint32_t OAM_SIZE = 0x400;
+    static constexpr uint32_t SRAM_SIZE = 0xffff;
+
+    // save states (see save_state.cpp)
+    struct Mem_state;
+    void save_state(Mem_state &state) const;
+    void load_state(const Mem_state &state);
+
     // probablly a better way do this than to just give free reign 
     // over the array (i.e for the video stuff give display class ownership)
 
@@ -46,6 +100,11 @@ public:
     // video ram
     std::vector<uint8_t> vram; // 0x18000
 
+    // vram written since the display last synced its tile cache
+    // one bit per 0x20 bytes (the size of a 4bpp tile)
+    static constexpr int VRAM_DIRTY_SHIFT = 5;
+    std::vector<uint64_t> vram_dirty;
+
     // display memory
 
     // bg/obj pallette ram
@@ -54,6 +113,10 @@ public:
     // object attribute map
     std::vector<uint8_t> oam; // 0x400 
 
+    // oam entries written since the display last parsed them
+    // one bit per 8 byte entry
+    uint64_t oam_dirty[2] = {~static_cast<uint64_t>(0),~static_cast<uint64_t>(0)};
+
 
 private:
     Debugger *debug;
@@ -145,6 +208,36 @@ private:
 
     Memory_region mem_region;
 
+
+    // page tables for the directly mapped regions
+    // so most accesses dont have to go through the handlers
+    // a null ptr means the access has to take the slow path
+    // (io, save memory, unmapped areas and anything with side effects)
+    static constexpr int PAGE_SHIFT = 14;
+    static constexpr uint32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+    static constexpr uint32_t PAGE_COUNT = 0x10000000 >> PAGE_SHIFT;
+
+    struct Page
+    {
+        uint8_t *ptr; // start of the underlying buffer
+        uint32_t mask; // mask to get the offset into it (handles mirroring)
+        Memory_region region;
+    };
+
+    std::vector<Page> read_pages;
+    std::vector<Page> write_pages;
+
+    void init_page_tables();
+    void map_pages(uint32_t start, uint32_t end, uint8_t *buf, 
+        uint32_t mask, Memory_region region, bool writeable);
+    void update_wram_write_page(uint32_t addr);
+
+    void mark_vram_dirty(uint32_t offset, uint32_t len);
+    void mark_oam_dirty(uint32_t offset, uint32_t len);
+
+    // host ptr for a range of memory if its all in one mapped buffer
+    uint8_t *get_range_ptr(const std::vector<Page> &pages, uint32_t addr, uint32_t len);
+
     // general memory
     // bios code
     std::vector<uint8_t> bios_rom; // 0x4000
@@ -158,14 +251,52 @@ private:
     // cart save ram
     std::vector<uint8_t> sram; // 0xffff
 
+    // wram pages that have cached code in them
+    std::vector<bool> board_wram_code; // 0x40000 >> CODE_PAGE_SHIFT
+    std::vector<bool> chip_wram_code; // 0x8000 >> CODE_PAGE_SHIFT
+
     bool ime = true;
 
+    uint32_t write_count = 0;
+
 
     // external memory
 
     // main game rom
-    std::vector<uint8_t> rom; // variable
+    // this is allways the full 32mb, anything past the end of the file reads as zero
+    // where it can its mapped from the file (and the kernels zero page after that)
+    // so every instance running the same rom shares the memory
+    static constexpr size_t ROM_MAX_SIZE = 32 * 1024 * 1024;
+    uint8_t *rom = nullptr;
+    size_t rom_size = 0;
+
+#ifndef ROM_MMAP_SUPPORTED
+    std::vector<uint8_t> rom_buf;
+#endif
+
+    void load_rom(const std::string &filename);
+
+    // forget all cached code in wram
+    void drop_code_pages();
+};
+
 
+// all the ram and io, the bios and rom are never written
+// so they are left out
+struct Mem::Mem_state
+{
+    uint8_t board_wram[BOARD_WRAM_SIZE];
+    uint8_t chip_wram[CHIP_WRAM_SIZE];
+    uint8_t io[IO_SIZE];
+    uint8_t pal_ram[PAL_RAM_SIZE];
+    uint8_t vram[VRAM_SIZE];
+    uint8_t oam[OAM_SIZE];
+    uint8_t sram[SRAM_SIZE];
+
+    int wait_states[10][3];
+    Memory_region mem_region;
+    uint32_t write_count;
+    bool ime;
 };
 
 
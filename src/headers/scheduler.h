@@ -0,0 +1,102 @@
+#pragma once
+#include "forward_def.h"
+#include "lib.h"
+
+// everything that needs to happen at a fixed point in time
+// rather than on every cycle
+enum class Gba_event
+{
+    DISPLAY = 0, // hblank / line end
+
+    // timer overflows
+    TIMER0 = 1,
+    TIMER1 = 2,
+    TIMER2 = 3,
+    TIMER3 = 4,
+
+    // dma start delays
+    DMA0 = 5,
+    DMA1 = 6,
+    DMA2 = 7,
+    DMA3 = 8,
+
+    // must allways be last
+    SIZE
+};
+
+constexpr int EVENT_SIZE = static_cast<int>(Gba_event::SIZE);
+
+// central timestamp ordered event list
+// the cpu just advances the timestamp and only
+// calls out to the other components when an event is actually due
+class Scheduler
+{
+public:
+    void init(Cpu *cpu, Display *disp);
+
+    // advance the current time and service anything that is due
+    void tick(int cycles)
+    {
+        timestamp += cycles;
+
+        if(timestamp >= min_timestamp)
+        {
+            service_events();
+        }
+    }
+
+    // schedule an event cycles from now
+    // (if its allready active it is moved)
+    void insert(Gba_event event, uint64_t cycles);
+
+    // schedule an event relative to when the last one of its kind was due
+    // this prevents drift for periodic events like the display
+    void insert_relative(Gba_event event, uint64_t cycles);
+
+    void remove(Gba_event event);
+
+    bool is_active(Gba_event event) const
+    {
+        return active[static_cast<int>(event)];
+    }
+
+    uint64_t get_timestamp() const { return timestamp; }
+
+    // how many events have been serviced (used for idle loop detection)
+    uint64_t get_events_serviced() const { return events_serviced; }
+
+    // how many cycles untill the next event
+    uint64_t get_next_event_cycles() const
+    {
+        return min_timestamp > timestamp? min_timestamp - timestamp : 0;
+    }
+
+    struct Scheduler_state
+    {
+        uint64_t timestamp;
+        uint64_t timestamps[EVENT_SIZE];
+        bool active[EVENT_SIZE];
+    };
+
+    void save_state(Scheduler_state &state) const;
+    void load_state(const Scheduler_state &state);
+
+private:
+    void service_events();
+    void service_event(Gba_event event);
+    void update_min_timestamp();
+
+    Cpu *cpu;
+    Display *disp;
+
+    // current time in cycles
+    uint64_t timestamp = 0;
+
+    uint64_t events_serviced = 0;
+
+    // earliest active event
+    uint64_t min_timestamp = std::numeric_limits<uint64_t>::max();
+
+    uint64_t timestamps[EVENT_SIZE] = {0};
+    bool active[EVENT_SIZE] = {false};
+};
@@ -0,0 +1,486 @@
+#include "headers/gba.h"
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <memory>
+
+
+// button names for the input script in keyinput bit order
+static const char *button_names[10] =
+{
+    "A","B","SELECT","START","RIGHT","LEFT","UP","DOWN","R","L"
+};
+
+
+bool GBA::load_input_script(const std::string &filename, std::vector<Input_event> &events)
+{
+    std::ifstream fp(filename);
+    if(!fp)
+    {
+        printf("unable to open input script %s\n",filename.c_str());
+        return false;
+    }
+
+    std::string line;
+    int line_num = 0;
+    while(std::getline(fp,line))
+    {
+        line_num++;
+
+        // strip comments
+        line = line.substr(0,line.find('#'));
+
+        std::istringstream stream(line);
+        Input_event event;
+
+        if(!(stream >> event.frame))
+        {
+            // blank line
+            if(stream.eof())
+            {
+                continue;
+            }
+
+            printf("%s:%d: expected a frame number\n",filename.c_str(),line_num);
+            return false;
+        }
+
+        // 1 = released
+        event.keyinput = 0x3ff;
+
+        std::string button;
+        while(stream >> button)
+        {
+            const auto it = std::find(std::begin(button_names),std::end(button_names),button);
+            if(it == std::end(button_names))
+            {
+                printf("%s:%d: unknown button %s\n",filename.c_str(),line_num,button.c_str());
+                return false;
+            }
+
+            event.keyinput = deset_bit(event.keyinput,std::distance(std::begin(button_names),it));
+        }
+
+        if(!events.empty() && event.frame < events.back().frame)
+        {
+            printf("%s:%d: frames must be in order\n",filename.c_str(),line_num);
+            return false;
+        }
+
+        events.push_back(event);
+    }
+
+    return true;
+}
+
+
+void GBA::write_screenshot(const std::string &filename)
+{
+    FILE *fp = fopen(filename.c_str(),"wb");
+    if(!fp)
+    {
+        printf("unable to open %s\n",filename.c_str());
+        return;
+    }
+
+    fprintf(fp,"P6\n%d %d\n255\n",disp.X,disp.Y);
+
+    for(int y = 0; y < disp.Y; y++)
+    {
+        for(int x = 0; x < disp.X; x++)
+        {
+            const uint32_t c = disp.screen[y][x];
+            const uint8_t rgb[3] = {uint8_t(c >> 16),uint8_t(c >> 8),uint8_t(c)};
+            fwrite(rgb,1,sizeof(rgb),fp);
+        }
+    }
+
+    fclose(fp);
+}
+
+
+void GBA::write_wram_dump(const std::string &filename)
+{
+    std::ofstream fp(filename,std::ios::binary);
+    if(!fp)
+    {
+        printf("unable to open %s\n",filename.c_str());
+        return;
+    }
+
+    const auto &board_wram = mem.get_board_wram();
+    const auto &chip_wram = mem.get_chip_wram();
+    fp.write(reinterpret_cast<const char*>(board_wram.data()),board_wram.size());
+    fp.write(reinterpret_cast<const char*>(chip_wram.data()),chip_wram.size());
+}
+
+
+// fnv-1a so runs can be compared without the data itself
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+static constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325;
+
+
+bool GBA::run_headless(const Headless_config &config, Headless_result &result)
+{
+    if(!config.frames && !config.cycles)
+    {
+        puts("headless mode needs a frame or cycle limit");
+        return false;
+    }
+
+    std::vector<Input_event> events;
+    if(!config.input_file.empty() && !load_input_script(config.input_file,events))
+    {
+        return false;
+    }
+
+    cpu.set_jit(config.jit);
+    cpu.set_hle_bios(config.hle);
+
+    if(!config.load_state_file.empty() && !load_state_file(config.load_state_file))
+    {
+        return false;
+    }
+
+    size_t event_idx = 0;
+    uint64_t frame = 0;
+    const uint64_t start_cycles = scheduler.get_timestamp();
+
+    for(;;)
+    {
+        // buttons for this frame
+        while(event_idx < events.size() && events[event_idx].frame <= frame)
+        {
+            mem.handle_write<uint16_t>(mem.io,IO_KEYINPUT&IO_MASK,events[event_idx++].keyinput);
+        }
+
+        if((config.frames && frame >= config.frames) ||
+            (config.cycles && scheduler.get_timestamp() - start_cycles >= config.cycles))
+        {
+            break;
+        }
+
+        while(!disp.new_vblank)
+        {
+            if(config.cycles && scheduler.get_timestamp() - start_cycles >= config.cycles)
+            {
+                break;
+            }
+
+            cpu.step();
+        }
+
+        if(disp.new_vblank)
+        {
+            disp.new_vblank = false;
+            frame++;
+        }
+    }
+
+    result.ok = true;
+    result.frames = frame;
+    result.cycles = scheduler.get_timestamp() - start_cycles;
+    result.pc = cpu.get_pc();
+    result.screen_hash = hash_bytes(FNV_OFFSET,disp.screen,sizeof(disp.screen));
+
+    const auto &board_wram = mem.get_board_wram();
+    const auto &chip_wram = mem.get_chip_wram();
+    result.wram_hash = hash_bytes(FNV_OFFSET,board_wram.data(),board_wram.size());
+    result.wram_hash = hash_bytes(result.wram_hash,chip_wram.data(),chip_wram.size());
+
+    if(!config.screenshot_file.empty())
+    {
+        write_screenshot(config.screenshot_file);
+    }
+
+    if(!config.dump_file.empty())
+    {
+        write_wram_dump(config.dump_file);
+    }
+
+    if(!config.save_state_file.empty())
+    {
+        save_state_file(config.save_state_file);
+    }
+
+    return true;
+}
+
+
+// parse <rom> [options] for one run
+static bool parse_job(const std::vector<std::string> &args, Headless_config &config)
+{
+    if(args.empty())
+    {
+        puts("no rom given");
+        return false;
+    }
+
+    config.rom = args[0];
+
+    for(size_t i = 1; i < args.size(); i++)
+    {
+        const std::string &opt = args[i];
+        const bool has_arg = i + 1 < args.size();
+
+        if(opt == "-jit")
+        {
+            config.jit = true;
+        }
+
+        else if(opt == "-hle")
+        {
+            config.hle = true;
+        }
+
+        else if(has_arg && opt == "-frames")
+        {
+            config.frames = strtoull(args[++i].c_str(),nullptr,0);
+        }
+
+        else if(has_arg && opt == "-cycles")
+        {
+            config.cycles = strtoull(args[++i].c_str(),nullptr,0);
+        }
+
+        else if(has_arg && opt == "-input")
+        {
+            config.input_file = args[++i];
+        }
+
+        else if(has_arg && opt == "-screenshot")
+        {
+            config.screenshot_file = args[++i];
+        }
+
+        else if(has_arg && opt == "-dump")
+        {
+            config.dump_file = args[++i];
+        }
+
+        else if(has_arg && opt == "-load-state")
+        {
+            config.load_state_file = args[++i];
+        }
+
+        else if(has_arg && opt == "-save-state")
+        {
+            config.save_state_file = args[++i];
+        }
+
+        else
+        {
+            printf("unknown option %s\n",opt.c_str());
+            return false;
+        }
+    }
+
+    if(!config.frames && !config.cycles)
+    {
+        printf("%s: needs a frame or cycle limit\n",config.rom.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+static void print_result(FILE *fp, const Headless_result &result)
+{
+    fprintf(fp,"%s %llu %llu %08x %016llx %016llx",result.ok? "ok" : "failed",
+        static_cast<unsigned long long>(result.frames),static_cast<unsigned long long>(result.cycles),
+        result.pc,static_cast<unsigned long long>(result.screen_hash),static_cast<unsigned long long>(result.wram_hash));
+}
+
+static constexpr const char *RESULT_HEADER = "status frames cycles pc screen wram";
+
+
+static int run_single(const Headless_config &config)
+{
+    Headless_result result;
+
+    try
+    {
+        GBA gba(config.rom);
+        if(!gba.run_headless(config,result))
+        {
+            return 1;
+        }
+    }
+
+    catch(const Emu_error &e)
+    {
+        printf("%s\n",e.what());
+        return 1;
+    }
+
+    printf("%s\n",RESULT_HEADER);
+    print_result(stdout,result);
+    printf("\n");
+    return 0;
+}
+
+
+// run one batch job on this thread
+// a fatal error in the core only fails this job
+static void run_job(size_t idx, const Headless_config &config, Headless_result &result)
+{
+    try
+    {
+        // cores are big so keep them off the thread stack
+        auto gba = std::make_unique<GBA>(config.rom);
+        gba->run_headless(config,result);
+    }
+
+    catch(const Emu_error &e)
+    {
+        fprintf(stderr,"job %zu (%s): %s\n",idx,config.rom.c_str(),e.what());
+        result = Headless_result();
+    }
+}
+
+
+// each line of the job file is a rom and its options as on the command line
+// runs every job on its own core and writes a report with a line per job
+static int run_batch(const std::string &job_file, unsigned int threads, const std::string &report_file)
+{
+    std::ifstream fp(job_file);
+    if(!fp)
+    {
+        printf("unable to open job file %s\n",job_file.c_str());
+        return 1;
+    }
+
+    std::vector<Headless_config> jobs;
+    std::string line;
+    while(std::getline(fp,line))
+    {
+        line = line.substr(0,line.find('#'));
+
+        std::istringstream stream(line);
+        std::vector<std::string> args{std::istream_iterator<std::string>(stream),std::istream_iterator<std::string>()};
+        if(args.empty())
+        {
+            continue;
+        }
+
+        Headless_config config;
+        if(!parse_job(args,config))
+        {
+            printf("%s: bad job on line %zu\n",job_file.c_str(),jobs.size() + 1);
+            return 1;
+        }
+        jobs.push_back(config);
+    }
+
+    std::vector<Headless_result> results(jobs.size());
+
+    // the jobs are all known up front so threads just claim the next one
+    // when they finish, which keeps every thread busy untill the end
+    std::atomic<size_t> next_job{0};
+
+    auto worker = [&]()
+    {
+        for(size_t i = next_job++; i < jobs.size(); i = next_job++)
+        {
+            run_job(i,jobs[i],results[i]);
+        }
+    };
+
+    threads = std::max(1u,std::min<unsigned int>(threads,jobs.size()));
+    std::vector<std::thread> pool;
+    for(unsigned int i = 0; i < threads; i++)
+    {
+        pool.emplace_back(worker);
+    }
+
+    for(auto &t : pool)
+    {
+        t.join();
+    }
+
+
+    FILE *out = report_file.empty()? stdout : fopen(report_file.c_str(),"w");
+    if(!out)
+    {
+        printf("unable to open report %s\n",report_file.c_str());
+        return 1;
+    }
+
+    bool all_ok = true;
+    fprintf(out,"job rom %s\n",RESULT_HEADER);
+    for(size_t i = 0; i < jobs.size(); i++)
+    {
+        fprintf(out,"%zu %s ",i,jobs[i].rom.c_str());
+        print_result(out,results[i]);
+        fprintf(out,"\n");
+        all_ok &= results[i].ok;
+    }
+
+    if(out != stdout)
+    {
+        fclose(out);
+    }
+
+    return all_ok? 0 : 1;
+}
+
+
+int headless_main(int argc, char *argv[])
+{
+    const std::vector<std::string> args(argv + 1,argv + argc);
+
+    if(args.empty())
+    {
+        printf("Usage %s <rom name> [-jit] [-hle] [-frames n] [-cycles n] [-input file] [-screenshot file] [-dump file]\n",argv[0]);
+        printf("      [-load-state file] [-save-state file]\n");
+        printf("      %s -batch <job file> [-threads n] [-report file]\n",argv[0]);
+        return 1;
+    }
+
+    if(args[0] != "-batch")
+    {
+        Headless_config config;
+        return parse_job(args,config)? run_single(config) : 1;
+    }
+
+    if(args.size() < 2)
+    {
+        puts("-batch needs a job file");
+        return 1;
+    }
+
+    unsigned int threads = std::thread::hardware_concurrency();
+    std::string report_file;
+
+    for(size_t i = 2; i < args.size(); i++)
+    {
+        if(i + 1 < args.size() && args[i] == "-threads")
+        {
+            threads = strtoul(args[++i].c_str(),nullptr,0);
+        }
+
+        else if(i + 1 < args.size() && args[i] == "-report")
+        {
+            report_file = args[++i];
+        }
+
+        else
+        {
+            printf("unknown option %s\n",args[i].c_str());
+            return 1;
+        }
+    }
+
+    return run_batch(args[1],threads,report_file);
+}
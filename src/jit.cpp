@@ -0,0 +1,745 @@
+#include "headers/jit.h"
+#include "headers/memory.h"
+#include <exception>
+
+#ifdef JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+
+// x86 register numbers
+constexpr int EAX = 0;
+constexpr int ECX = 1;
+constexpr int EDX = 2;
+constexpr int EBX = 3;
+constexpr int ESI = 6;
+
+// opcodes for op r/m32, r32
+constexpr uint8_t X86_ADD = 0x01;
+constexpr uint8_t X86_OR = 0x09;
+constexpr uint8_t X86_AND = 0x21;
+constexpr uint8_t X86_SUB = 0x29;
+constexpr uint8_t X86_XOR = 0x31;
+
+// reg field for shift group 2
+constexpr int X86_ROR = 1;
+constexpr int X86_SHL = 4;
+constexpr int X86_SHR = 5;
+constexpr int X86_SAR = 7;
+
+
+// exceptions cant unwind through generated code
+// so the callbacks hold onto any error untill the block returns
+static thread_local std::exception_ptr jit_error;
+
+// memory callbacks from generated code
+// these do exactly what the interpreter handlers do for the access
+static uint32_t jit_read_word(Mem *mem, uint32_t addr) noexcept
+{
+    try
+    {
+        uint32_t v = mem->read_memt<uint32_t>(addr);
+        return rotr(v,(addr&3)*8);
+    }
+
+    catch(...)
+    {
+        jit_error = std::current_exception();
+        return 0;
+    }
+}
+
+static uint32_t jit_read_byte(Mem *mem, uint32_t addr) noexcept
+{
+    try
+    {
+        return mem->read_memt<uint8_t>(addr);
+    }
+
+    catch(...)
+    {
+        jit_error = std::current_exception();
+        return 0;
+    }
+}
+
+static void jit_write_word(Mem *mem, uint32_t addr, uint32_t v) noexcept
+{
+    try
+    {
+        mem->write_memt<uint32_t>(addr,v);
+    }
+
+    catch(...)
+    {
+        jit_error = std::current_exception();
+    }
+}
+
+static void jit_write_byte(Mem *mem, uint32_t addr, uint32_t v) noexcept
+{
+    try
+    {
+        mem->write_memt<uint8_t>(addr,v);
+    }
+
+    catch(...)
+    {
+        jit_error = std::current_exception();
+    }
+}
+
+
+
+void Jit::init(Mem *mem)
+{
+    this->mem = mem;
+}
+
+Jit::~Jit()
+{
+#ifdef JIT_SUPPORTED
+    if(code_buffer)
+    {
+        munmap(code_buffer,CODE_BUFFER_SIZE);
+    }
+#endif
+}
+
+void Jit::set_enabled(bool enable)
+{
+    if(!enable)
+    {
+        enabled = false;
+        return;
+    }
+
+#ifdef JIT_SUPPORTED
+    if(!code_buffer)
+    {
+        void *buf = mmap(nullptr,CODE_BUFFER_SIZE,PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+
+        if(buf == MAP_FAILED)
+        {
+            puts("jit: unable to allocate code buffer, using the interpreter");
+            return;
+        }
+        code_buffer = static_cast<uint8_t*>(buf);
+    }
+    enabled = true;
+#else
+    puts("jit: not supported on this platform, using the interpreter");
+#endif
+}
+
+void Jit::run(JIT_FPTR code, uint32_t *regs)
+{
+    code(regs);
+
+    if(jit_error)
+    {
+        std::rethrow_exception(std::exchange(jit_error,nullptr));
+    }
+}
+
+
+void Jit::flush()
+{
+    rom_blocks.clear();
+    ram_blocks.clear();
+    code_used = 0;
+}
+
+
+Jit::Jit_block *Jit::lookup(uint32_t pc, bool is_thumb)
+{
+    bool is_ram = false;
+
+    // only bios, wram and rom are worth compiling
+    switch((pc >> 24) & 0xf)
+    {
+        case 0x0: case 0x8: case 0x9: case 0xa:
+        case 0xb: case 0xc: case 0xd: break;
+
+        case 0x2: case 0x3: is_ram = true; break;
+
+        default: return nullptr;
+    }
+
+    // make sure there is allways enough room for a max size block
+    if(CODE_BUFFER_SIZE - code_used < 64 * 1024)
+    {
+        flush();
+    }
+
+    auto &blocks = is_ram? ram_blocks : rom_blocks;
+    const uint32_t key = pc | is_thumb;
+
+    auto it = blocks.find(key);
+    if(it == blocks.end())
+    {
+        it = blocks.emplace(key,Jit_block{}).first;
+        it->second.addr = pc;
+    }
+
+    Jit_block &block = it->second;
+
+    if(!block.compiled && ++block.hits >= HOT_THRESHOLD)
+    {
+        compile(block,is_thumb);
+    }
+
+    return block.code? &block : nullptr;
+}
+
+
+void Jit::invalidate(uint32_t addr)
+{
+    // wram is mirrored so compare offsets not addresses
+    const uint32_t region = (addr >> 24) & 0xf;
+    const uint32_t mask = region == 0x2? 0x3ffff : 0x7fff;
+
+    const uint32_t page_start = addr & mask;
+    const uint32_t page_end = page_start + Mem::CODE_PAGE_SIZE;
+
+    // the code itself is only reclaimed on a flush
+    for(auto it = ram_blocks.begin(); it != ram_blocks.end();)
+    {
+        const auto &block = it->second;
+        const uint32_t start = block.addr & mask;
+        const uint32_t end = start + block.size;
+
+        if(((block.addr >> 24) & 0xf) == region && start < page_end && end > page_start)
+        {
+            it = ram_blocks.erase(it);
+        }
+
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+
+void Jit::compile(Jit_block &block, bool is_thumb)
+{
+    block.compiled = true;
+
+    const uint32_t size = is_thumb? ARM_HALF_SIZE : ARM_WORD_SIZE;
+    const bool is_rom = ((block.addr >> 24) & 0xf) >= 0x8;
+
+    code.clear();
+    emit_prologue();
+
+    uint32_t pc = block.addr;
+    uint32_t n = 0;
+    int cycles = 0;
+    stored = false;
+
+    for(; n < MAX_BLOCK_INSTRS; n++, pc += size)
+    {
+        // dont read off the end of the rom
+        if(is_rom && (pc & 0x1ffffff) + size > mem->get_rom_size())
+        {
+            break;
+        }
+
+        int instr_cycles = 0;
+        bool success;
+        if(is_thumb)
+        {
+            const uint16_t opcode = mem->read_mem<uint16_t>(pc);
+            instr_cycles += mem->get_access_cycles(HALF);
+            success = compile_thumb(pc,opcode,instr_cycles);
+        }
+
+        else
+        {
+            const uint32_t opcode = mem->read_mem<uint32_t>(pc);
+            instr_cycles += mem->get_access_cycles(WORD);
+            success = compile_arm(opcode,instr_cycles);
+        }
+
+        if(!success)
+        {
+            break;
+        }
+
+        cycles += instr_cycles;
+        mem->mark_code_page(pc);
+
+        // the store could hit io (halt, irqs, dma) and that has to take effect
+        // before anything after it runs, so hand back once its been charged for
+        if(stored)
+        {
+            n++;
+            break;
+        }
+    }
+
+    // first instr could not be compiled
+    // the empty block stays so we dont keep retrying it, but it still covers
+    // the instr so new code written over it will invalidate it
+    if(n == 0)
+    {
+        block.size = size;
+        mem->mark_code_page(block.addr);
+        return;
+    }
+
+    emit_epilogue();
+
+    uint8_t *dst = code_buffer + code_used;
+    memcpy(dst,code.data(),code.size());
+    code_used += code.size();
+
+    block.code = reinterpret_cast<JIT_FPTR>(dst);
+    block.size = n * size;
+    block.cycles = cycles;
+}
+
+
+// nothing is emitted unless the whole instr can be translated
+bool Jit::compile_arm(uint32_t opcode, int &cycles)
+{
+    // only unconditional instrs
+    if(((opcode >> 28) & 0xf) != AL)
+    {
+        return false;
+    }
+
+    const int rd = (opcode >> 12) & 0xf;
+    const int rn = (opcode >> 16) & 0xf;
+
+    switch((opcode >> 26) & 0x3)
+    {
+        // ARM.5: data processing
+        case 0b00:
+        {
+            const bool imm = is_set(opcode,25);
+            const bool s = is_set(opcode,20);
+            const int op = (opcode >> 21) & 0xf;
+            const int rm = opcode & 0xf;
+
+            // no flags, no psr transfers or tests, no register shifts
+            // (which also rules out mul, swp and the hds transfers)
+            if(s || (op >= 0x8 && op <= 0xb) || (!imm && is_set(opcode,4)))
+            {
+                return false;
+            }
+
+            // adc, sbc and rsc need the carry
+            if(op == 0x5 || op == 0x6 || op == 0x7)
+            {
+                return false;
+            }
+
+            // pc relative operands or writes
+            if(rd == PC || rn == PC || (!imm && rm == PC))
+            {
+                return false;
+            }
+
+            const Shift_type type = static_cast<Shift_type>((opcode >> 5) & 0x3);
+            const int shift = (opcode >> 7) & 0x1f;
+
+            // ror #0 is rrx which needs the carry
+            if(!imm && type == ROR && shift == 0)
+            {
+                return false;
+            }
+
+            // operand 2 into ecx
+            if(imm)
+            {
+                emit_mov_imm(ECX,get_arm_operand2_imm(opcode));
+            }
+
+            else
+            {
+                emit_load_reg(ECX,rm);
+                switch(type)
+                {
+                    case LSL:
+                    {
+                        if(shift)
+                        {
+                            emit_shift_imm(X86_SHL,ECX,shift);
+                        }
+                        break;
+                    }
+
+                    // lsr #0 is lsr #32
+                    case LSR:
+                    {
+                        if(shift)
+                        {
+                            emit_shift_imm(X86_SHR,ECX,shift);
+                        }
+
+                        else
+                        {
+                            emit_mov_imm(ECX,0);
+                        }
+                        break;
+                    }
+
+                    // asr #0 is asr #32
+                    case ASR:
+                    {
+                        emit_shift_imm(X86_SAR,ECX,shift? shift : 31);
+                        break;
+                    }
+
+                    case ROR:
+                    {
+                        emit_shift_imm(X86_ROR,ECX,shift);
+                        break;
+                    }
+                }
+            }
+
+            // result into eax
+            switch(op)
+            {
+                case 0x0: // and
+                {
+                    emit_load_reg(EAX,rn);
+                    emit_alu(X86_AND,EAX,ECX);
+                    break;
+                }
+
+                case 0x1: // eor
+                {
+                    emit_load_reg(EAX,rn);
+                    emit_alu(X86_XOR,EAX,ECX);
+                    break;
+                }
+
+                case 0x2: // sub
+                {
+                    emit_load_reg(EAX,rn);
+                    emit_alu(X86_SUB,EAX,ECX);
+                    break;
+                }
+
+                case 0x3: // rsb
+                {
+                    emit_load_reg(EAX,rn);
+                    emit_alu(X86_SUB,ECX,EAX);
+                    emit_mov(EAX,ECX);
+                    break;
+                }
+
+                case 0x4: // add
+                {
+                    emit_load_reg(EAX,rn);
+                    emit_alu(X86_ADD,EAX,ECX);
+                    break;
+                }
+
+                case 0xc: // orr
+                {
+                    emit_load_reg(EAX,rn);
+                    emit_alu(X86_OR,EAX,ECX);
+                    break;
+                }
+
+                case 0xd: // mov
+                {
+                    emit_mov(EAX,ECX);
+                    break;
+                }
+
+                case 0xe: // bic
+                {
+                    emit_not(ECX);
+                    emit_load_reg(EAX,rn);
+                    emit_alu(X86_AND,EAX,ECX);
+                    break;
+                }
+
+                case 0xf: // mvn
+                {
+                    emit_not(ECX);
+                    emit_mov(EAX,ECX);
+                    break;
+                }
+            }
+
+            emit_store_reg(rd,EAX);
+            cycles += 1; // 1s
+            return true;
+        }
+
+        // ARM.9: single data transfer
+        case 0b01:
+        {
+            const bool reg_offset = is_set(opcode,25);
+            const bool p = is_set(opcode,24);
+            const bool u = is_set(opcode,23);
+            const bool is_byte = is_set(opcode,22);
+            const bool w = is_set(opcode,21);
+            const bool l = is_set(opcode,20);
+
+            // only pre indexed immediate offsets without writeback
+            if(reg_offset || !p || w || rd == PC || rn == PC)
+            {
+                return false;
+            }
+
+            const int32_t offset = opcode & 0xfff;
+            emit_load_store(l,is_byte,rd,rn,u? offset : -offset);
+
+            // 1s + 1n + 1i for ldr 2n for str
+            cycles += l? 3 : 2;
+            return true;
+        }
+
+        default: return false;
+    }
+}
+
+
+bool Jit::compile_thumb(uint32_t pc, uint16_t opcode, int &cycles)
+{
+    // THUMB.5: hi register add / mov (these dont set flags)
+    if(((opcode >> 10) & 0b111111) == 0b010001)
+    {
+        const int op = (opcode >> 8) & 0x3;
+        const int rd = (opcode & 0x7) | (is_set(opcode,7) << 3);
+        const int rs = ((opcode >> 3) & 0x7) | (is_set(opcode,6) << 3);
+
+        if((op != 0b00 && op != 0b10) || rd == PC || rs == PC)
+        {
+            return false;
+        }
+
+        emit_load_reg(EAX,rs);
+        if(op == 0b00) // add
+        {
+            emit_load_reg(ECX,rd);
+            emit_alu(X86_ADD,EAX,ECX);
+        }
+        emit_store_reg(rd,EAX);
+
+        cycles += 1; // 1s
+        return true;
+    }
+
+    // THUMB.13: add offset to stack pointer
+    else if(((opcode >> 8) & 0xff) == 0b10110000)
+    {
+        const uint32_t nn = (opcode & 127) * 4;
+        emit_add_imm(SP,SP,is_set(opcode,7)? -nn : nn);
+        cycles += 1; // 1s
+        return true;
+    }
+
+    // THUMB.12: get relative address
+    else if(((opcode >> 12) & 0xf) == 0b1010)
+    {
+        const uint32_t offset = (opcode & 0xff) * 4;
+        const int rd = (opcode >> 8) & 0x7;
+
+        if(is_set(opcode,11)) // sp
+        {
+            emit_add_imm(rd,SP,offset);
+        }
+
+        // pc is a constant at this point
+        else
+        {
+            emit_mov_imm(EAX,((pc + 4) & ~2) + offset);
+            emit_store_reg(rd,EAX);
+        }
+
+        cycles += 1; // 1s
+        return true;
+    }
+
+    // THUMB.9: load/store with immediate offset
+    else if(((opcode >> 13) & 0b111) == 0b011)
+    {
+        const int op = (opcode >> 11) & 0x3;
+        const int imm = (opcode >> 6) & 0x1f;
+        const int rb = (opcode >> 3) & 0x7;
+        const int rd = opcode & 0x7;
+
+        const bool is_byte = is_set(op,1);
+        const bool load = is_set(op,0);
+
+        emit_load_store(load,is_byte,rd,rb,is_byte? imm : imm * 4);
+
+        // 1s + 1n + 1i for ldr 2n for str
+        cycles += load? 3 : 2;
+        return true;
+    }
+
+    // THUMB.11: load/store SP-relative
+    else if(((opcode >> 12) & 0xf) == 0b1001)
+    {
+        const int rd = (opcode >> 8) & 0x7;
+        const bool load = is_set(opcode,11);
+
+        emit_load_store(load,false,rd,SP,(opcode & 0xff) * 4);
+        cycles += load? 3 : 2;
+        return true;
+    }
+
+    return false;
+}
+
+
+
+// call back into mem for the access
+// esi holds the address, edx the value to store
+void Jit::emit_load_store(bool load, bool byte, int rd, int rn, int32_t offset)
+{
+    emit_load_reg(ESI,rn);
+    if(offset)
+    {
+        // add esi, imm32
+        emit8(0x81);
+        emit8(0xc0 | ESI);
+        emit32(offset);
+    }
+
+    if(!load)
+    {
+        emit_load_reg(EDX,rd);
+    }
+
+    // mov rdi, mem
+    emit8(0x48);
+    emit8(0xbf);
+    emit64(reinterpret_cast<uint64_t>(mem));
+
+    if(load)
+    {
+        emit_call(reinterpret_cast<const void*>(byte? &jit_read_byte : &jit_read_word));
+        emit_store_reg(rd,EAX);
+    }
+
+    else
+    {
+        emit_call(reinterpret_cast<const void*>(byte? &jit_write_byte : &jit_write_word));
+        stored = true;
+    }
+}
+
+void Jit::emit_add_imm(int rd, int rn, uint32_t imm)
+{
+    emit_load_reg(EAX,rn);
+
+    // add eax, imm32
+    emit8(0x05);
+    emit32(imm);
+
+    emit_store_reg(rd,EAX);
+}
+
+
+
+void Jit::emit8(uint8_t v)
+{
+    code.push_back(v);
+}
+
+void Jit::emit32(uint32_t v)
+{
+    for(int i = 0; i < 4; i++)
+    {
+        emit8((v >> (i * 8)) & 0xff);
+    }
+}
+
+void Jit::emit64(uint64_t v)
+{
+    emit32(v & 0xffffffff);
+    emit32(v >> 32);
+}
+
+// regs array lives in rbx for the whole block
+// mov r32, [rbx + arm_reg * 4]
+void Jit::emit_load_reg(int x86_reg, int arm_reg)
+{
+    emit8(0x8b);
+    emit8(0x40 | (x86_reg << 3) | EBX);
+    emit8(arm_reg * 4);
+}
+
+// mov [rbx + arm_reg * 4], r32
+void Jit::emit_store_reg(int arm_reg, int x86_reg)
+{
+    emit8(0x89);
+    emit8(0x40 | (x86_reg << 3) | EBX);
+    emit8(arm_reg * 4);
+}
+
+// mov r32, imm32
+void Jit::emit_mov_imm(int x86_reg, uint32_t imm)
+{
+    emit8(0xb8 + x86_reg);
+    emit32(imm);
+}
+
+// mov dst, src
+void Jit::emit_mov(int dst, int src)
+{
+    emit8(0x89);
+    emit8(0xc0 | (src << 3) | dst);
+}
+
+// op dst, src
+void Jit::emit_alu(uint8_t op, int dst, int src)
+{
+    emit8(op);
+    emit8(0xc0 | (src << 3) | dst);
+}
+
+// shift r32, imm8
+void Jit::emit_shift_imm(int ext, int x86_reg, int n)
+{
+    emit8(0xc1);
+    emit8(0xc0 | (ext << 3) | x86_reg);
+    emit8(n);
+}
+
+// not r32
+void Jit::emit_not(int x86_reg)
+{
+    emit8(0xf7);
+    emit8(0xc0 | (2 << 3) | x86_reg);
+}
+
+// mov rax, func
+// call rax
+void Jit::emit_call(const void *func)
+{
+    emit8(0x48);
+    emit8(0xb8);
+    emit64(reinterpret_cast<uint64_t>(func));
+    emit8(0xff);
+    emit8(0xd0);
+}
+
+// push rbx
+// mov rbx, rdi
+void Jit::emit_prologue()
+{
+    emit8(0x53);
+    emit8(0x48);
+    emit8(0x89);
+    emit8(0xfb);
+}
+
+// pop rbx
+// ret
+void Jit::emit_epilogue()
+{
+    emit8(0x5b);
+    emit8(0xc3);
+}
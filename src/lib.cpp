@@ -8,8 +8,7 @@ void read_file(std::string filename, std::vector<uint8_t> &buf)
 
     if(!fp)
     {
-        std::cout << "failed to open file: " << filename;
-        exit(1);
+        throw Emu_error("failed to open file: " + filename);
     }
 
 
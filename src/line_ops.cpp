@@ -0,0 +1,109 @@
+#include "headers/line_ops.h"
+
+#ifdef SIMD_RENDER_SUPPORTED
+#include <immintrin.h>
+#endif
+
+
+static void expand_row_scalar(uint32_t *out, const uint8_t *row, const uint32_t *pal, bool x_flip)
+{
+    for(int x = 0; x < 8; x++)
+    {
+        const uint8_t idx = row[x_flip? 7-x : x];
+        out[x] = idx? pal[idx] : 0;
+    }
+}
+
+static void merge_line_scalar(uint32_t *dst, const uint32_t *src, int len)
+{
+    for(int x = 0; x < len; x++)
+    {
+        dst[x] = src[x]? src[x] : dst[x];
+    }
+}
+
+
+#ifdef SIMD_RENDER_SUPPORTED
+
+// sse has no gather so it only gets the merge
+__attribute__((target("sse4.1")))
+static void merge_line_sse(uint32_t *dst, const uint32_t *src, int len)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int x = 0;
+    for(; x + 4 <= len; x += 4)
+    {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + x));
+        const __m128i transparent = _mm_cmpeq_epi32(s,zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),_mm_blendv_epi8(s,d,transparent));
+    }
+
+    merge_line_scalar(dst + x,src + x,len - x);
+}
+
+
+__attribute__((target("avx2")))
+static void expand_row_avx2(uint32_t *out, const uint8_t *row, const uint32_t *pal, bool x_flip)
+{
+    __m128i idx8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row));
+
+    if(x_flip)
+    {
+        const __m128i reverse = _mm_set_epi8(15,14,13,12,11,10,9,8,0,1,2,3,4,5,6,7);
+        idx8 = _mm_shuffle_epi8(idx8,reverse);
+    }
+
+    const __m256i idx = _mm256_cvtepu8_epi32(idx8);
+    const __m256i color = _mm256_i32gather_epi32(reinterpret_cast<const int*>(pal),idx,4);
+    const __m256i transparent = _mm256_cmpeq_epi32(idx,_mm256_setzero_si256());
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),_mm256_andnot_si256(transparent,color));
+}
+
+__attribute__((target("avx2")))
+static void merge_line_avx2(uint32_t *dst, const uint32_t *src, int len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    int x = 0;
+    for(; x + 8 <= len; x += 8)
+    {
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x));
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + x));
+        const __m256i transparent = _mm256_cmpeq_epi32(s,zero);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x),_mm256_blendv_epi8(s,d,transparent));
+    }
+
+    merge_line_scalar(dst + x,src + x,len - x);
+}
+
+#endif
+
+
+static Line_ops pick_line_ops()
+{
+#ifdef SIMD_RENDER_SUPPORTED
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+    {
+        return Line_ops{expand_row_avx2,merge_line_avx2};
+    }
+
+    if(__builtin_cpu_supports("sse4.1"))
+    {
+        return Line_ops{expand_row_scalar,merge_line_sse};
+    }
+#endif
+
+    return Line_ops{expand_row_scalar,merge_line_scalar};
+}
+
+Line_ops get_line_ops()
+{
+    // only probe the host once even with several displays on different threads
+    static const Line_ops ops = pick_line_ops();
+    return ops;
+}
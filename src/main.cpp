@@ -1,20 +1,88 @@
 #include "headers/gba.h"
 #include <stdio.h>
+#include <cmath>
 
-int main(int argc, char *argv[])
+#ifndef HEADLESS
+static int run_frontend(int argc, char *argv[])
 {
-
-    if(argc != 2)
+    if(argc < 2)
     {
-        printf("Usage %s <rom name>",argv[0]);
-        return 0;
+        printf("Usage %s <rom name> [-jit] [-hle] [-uncapped] [-speed multiplier]\n",argv[0]);
+        return 1;
     }
 
     GBA gba(argv[1]);
 
+    for(int i = 2; i < argc; i++)
+    {
+        const std::string opt = argv[i];
+
+        if(opt == "-jit")
+        {
+            gba.set_jit(true);
+        }
+
+        else if(opt == "-hle")
+        {
+            gba.set_hle_bios(true);
+        }
+
+        else if(opt == "-uncapped")
+        {
+            gba.set_pacing(Frame_pacing::UNCAPPED);
+        }
+
+        else if(i + 1 < argc && opt == "-speed")
+        {
+            const double speed = strtod(argv[++i],nullptr);
+            if(!std::isfinite(speed) || speed <= 0.0)
+            {
+                printf("invalid speed %s\n",argv[i]);
+                return 1;
+            }
+            gba.set_pacing(Frame_pacing::MULTIPLIER,speed);
+        }
+
+        else
+        {
+            printf("unknown option %s\n",argv[i]);
+            return 1;
+        }
+    }
+
 
     // start the emulation
-    gba.run();
+    try
+    {
+        gba.run();
+    }
 
-    return 0;   
-}
\ No newline at end of file
+    catch(const Emu_error &e)
+    {
+        printf("%s\n",e.what());
+        gba.print_regs();
+        return 1;
+    }
+
+    return 0;
+}
+#endif
+
+
+int main(int argc, char *argv[])
+{
+#ifdef HEADLESS
+    return headless_main(argc,argv);
+#else
+    try
+    {
+        return run_frontend(argc,argv);
+    }
+
+    catch(const Emu_error &e)
+    {
+        printf("%s\n",e.what());
+        return 1;
+    }
+#endif
+}
@@ -3,6 +3,13 @@
 #include "headers/debugger.h"
 #include "headers/display.h"
 
+#ifdef ROM_MMAP_SUPPORTED
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 
 
 // template instantsation for our memory reads
@@ -43,22 +50,29 @@ void Mem::init(std::string filename, Debugger *debug,Cpu *cpu,Display *disp)
     this->disp = disp;
 
     // read out rom
-    read_file(filename,rom);
+    load_rom(filename);
 
     
 
     // alloc our underlying system memory
-    bios_rom.resize(0x4000);
-    board_wram.resize(0x40000);
-    chip_wram.resize(0x8000);
-    io.resize(0x400);
-    pal_ram.resize(0x400);
-    vram.resize(0x18000);
-    oam.resize(0x400); 
-    sram.resize(0xffff);
+    bios_rom.resize(BIOS_SIZE);
+    board_wram.resize(BOARD_WRAM_SIZE);
+    chip_wram.resize(CHIP_WRAM_SIZE);
+    io.resize(IO_SIZE);
+    pal_ram.resize(PAL_RAM_SIZE);
+    vram.resize(VRAM_SIZE);
+    vram_dirty.assign((vram.size() >> VRAM_DIRTY_SHIFT) / 64,~static_cast<uint64_t>(0));
+    oam.resize(OAM_SIZE); 
+    sram.resize(SRAM_SIZE);
+
+    board_wram_code.resize(board_wram.size() >> CODE_PAGE_SHIFT);
+    chip_wram_code.resize(chip_wram.size() >> CODE_PAGE_SHIFT);
     
     // read out rom info here...
-    std::cout << "rom size: " << rom.size() << "\n";
+    // (headless runs keep stdout for their results)
+#ifndef HEADLESS
+    std::cout << "rom size: " << rom_size << "\n";
+#endif
 
 
     // all unpressed
@@ -70,10 +84,323 @@ void Mem::init(std::string filename, Debugger *debug,Cpu *cpu,Display *disp)
     // read and copy in the bios rom
     read_file("GBA.BIOS",bios_rom);
 
-    if(bios_rom.size() != 0x4000)
+    if(bios_rom.size() != BIOS_SIZE)
+    {
+        throw Emu_error("invalid bios size!");
+    }
+
+    // all buffers are now at there final size
+    init_page_tables();
+}
+
+
+Mem::~Mem()
+{
+#ifdef ROM_MMAP_SUPPORTED
+    if(rom)
+    {
+        munmap(rom,ROM_MAX_SIZE);
+    }
+#endif
+}
+
+
+void Mem::load_rom(const std::string &filename)
+{
+#ifdef ROM_MMAP_SUPPORTED
+    const int fd = open(filename.c_str(),O_RDONLY);
+    struct stat st;
+
+    if(fd < 0 || fstat(fd,&st) != 0)
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        throw Emu_error("failed to open file: " + filename);
+    }
+
+    rom_size = st.st_size;
+    if(rom_size > ROM_MAX_SIZE)
+    {
+        close(fd);
+        throw Emu_error("rom too large!");
+    }
+
+    // reserve the whole 32mb as zeros then put the file over the start of it
+    // (the kernel zero fills the rest of the last page)
+    void *base = mmap(nullptr,ROM_MAX_SIZE,PROT_READ,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    const bool mapped = base != MAP_FAILED && 
+        (!rom_size || mmap(base,rom_size,PROT_READ,MAP_PRIVATE | MAP_FIXED,fd,0) != MAP_FAILED);
+    close(fd);
+
+    if(!mapped)
+    {
+        if(base != MAP_FAILED)
+        {
+            munmap(base,ROM_MAX_SIZE);
+        }
+        throw Emu_error("failed to map file: " + filename);
+    }
+
+    rom = static_cast<uint8_t*>(base);
+#else
+    read_file(filename,rom_buf);
+
+    rom_size = rom_buf.size();
+    if(rom_size > ROM_MAX_SIZE)
+    {
+        throw Emu_error("rom too large!");
+    }
+
+    rom_buf.resize(ROM_MAX_SIZE);
+    rom = rom_buf.data();
+#endif
+}
+
+
+void Mem::init_page_tables()
+{
+    read_pages.assign(PAGE_COUNT,Page{nullptr,0,UNDEFINED});
+    write_pages.assign(PAGE_COUNT,Page{nullptr,0,UNDEFINED});
+
+    map_pages(0x00000000,0x00004000,bios_rom.data(),0x3fff,BIOS,false);
+    map_pages(0x02000000,0x03000000,board_wram.data(),0x3ffff,WRAM_BOARD,true);
+    map_pages(0x03000000,0x04000000,chip_wram.data(),0x7fff,WRAM_CHIP,true);
+    // palette writes have to update the display's color cache
+    map_pages(0x05000000,0x06000000,pal_ram.data(),0x3ff,PAL,false);
+    // vram writes have to mark the display's tile cache dirty
+    map_pages(0x06000000,0x06018000,vram.data(),0x1ffff,VRAM,false);
+    // oam writes have to make the display reparse the sprite
+    map_pages(0x07000000,0x08000000,oam.data(),0x3ff,OAM,false);
+
+    // the rom is padded out to the full 32mb so every wait state mirror
+    // can be mapped completely
+    for(uint32_t base = 0x08000000; base < 0x0e000000; base += 0x02000000)
+    {
+        map_pages(base,base + ROM_MAX_SIZE,rom,ROM_MAX_SIZE - 1,ROM,false);
+    }
+}
+
+void Mem::map_pages(uint32_t start, uint32_t end, uint8_t *buf, 
+    uint32_t mask, Memory_region region, bool writeable)
+{
+    const Page page = {buf,mask,region};
+
+    for(uint32_t addr = start; addr < end; addr += PAGE_SIZE)
+    {
+        read_pages[addr >> PAGE_SHIFT] = page;
+
+        // wram writes can invalidate cached code
+        // so they only get a fast path in the first mirror
+        // where we can cheaply take it away again
+        const bool is_wram = region == WRAM_BOARD || region == WRAM_CHIP;
+        if(writeable && (!is_wram || (addr & 0x00ffffff) <= mask))
+        {
+            write_pages[addr >> PAGE_SHIFT] = page;
+        }
+    }
+}
+
+// pages with cached code in them are kept out of the write table
+// so writes to them go through the handlers and invalidate the code
+void Mem::update_wram_write_page(uint32_t addr)
+{
+    const bool is_board = ((addr >> 24) & 0xf) == 0x2;
+    auto &buf = is_board? board_wram : chip_wram;
+    const auto &code_pages = is_board? board_wram_code : chip_wram_code;
+
+    const uint32_t mask = buf.size() - 1;
+    const uint32_t offset = addr & mask & ~(PAGE_SIZE - 1);
+
+    bool has_code = false;
+    for(uint32_t i = offset >> CODE_PAGE_SHIFT; i < (offset + PAGE_SIZE) >> CODE_PAGE_SHIFT; i++)
+    {
+        has_code |= code_pages[i];
+    }
+
+    Page &page = write_pages[((addr & 0x0f000000) | offset) >> PAGE_SHIFT];
+    page = has_code? Page{nullptr,0,UNDEFINED} : Page{buf.data(),mask,is_board? WRAM_BOARD : WRAM_CHIP};
+}
+
+
+uint8_t *Mem::get_range_ptr(const std::vector<Page> &pages, uint32_t addr, uint32_t len)
+{
+    if(addr + len > 0x10000000)
+    {
+        return nullptr;
+    }
+
+    // range cant wrap round a mirror
+    const Page &page = pages[addr >> PAGE_SHIFT];
+    if(!page.ptr || (addr & page.mask) + len > page.mask + 1)
+    {
+        return nullptr;
+    }
+
+    // and every page it covers has to be mapped to the same buffer
+    for(uint32_t a = addr & ~(PAGE_SIZE - 1); a < addr + len; a += PAGE_SIZE)
+    {
+        if(pages[a >> PAGE_SHIFT].ptr != page.ptr)
+        {
+            return nullptr;
+        }
+    }
+
+    return page.ptr + (addr & page.mask);
+}
+
+bool Mem::dma_copy(uint32_t src, uint32_t dst, uint32_t cnt, bool is_half, bool src_fixed)
+{
+    const uint32_t size = is_half? ARM_HALF_SIZE : ARM_WORD_SIZE;
+    const uint32_t len = cnt * size;
+
+    src &= ~(size - 1);
+    dst &= ~(size - 1);
+
+    // write pages for wram with cached code are unmapped
+    // so those allways fall back and invalidate properly
+    const uint8_t *src_ptr = get_range_ptr(read_pages,src,src_fixed? size : len);
+    uint8_t *dst_ptr = get_range_ptr(write_pages,dst,len);
+
+    // vram, oam and palette ram arent in the write table so single writes can mark
+    // what the display has to redo, but a bulk copy can just mark the whole range up front
+    // (the palette cache is updated after the copy as it reads the new colors)
+    const Memory_region dst_region = read_pages[dst >> PAGE_SHIFT].region;
+    if(!dst_ptr && (dst_region == VRAM || dst_region == OAM || dst_region == PAL))
+    {
+        dst_ptr = get_range_ptr(read_pages,dst,len);
+        if(dst_ptr && dst_region == VRAM)
+        {
+            mark_vram_dirty(dst_ptr - vram.data(),len);
+        }
+
+        else if(dst_ptr && dst_region == OAM)
+        {
+            mark_oam_dirty(dst_ptr - oam.data(),len);
+        }
+    }
+
+    if(!src_ptr || !dst_ptr)
+    {
+        return false;
+    }
+
+    if(src_fixed)
+    {
+        for(uint32_t i = 0; i < len; i += size)
+        {
+            memcpy(dst_ptr + i,src_ptr,size);
+        }
+    }
+
+    else
+    {
+        // a unit by unit copy forward over itself repeats the data
+        // which memmove wont do
+        if(dst_ptr > src_ptr && dst_ptr < src_ptr + len)
+        {
+            return false;
+        }
+
+        memmove(dst_ptr,src_ptr,len);
+    }
+
+    if(dst_region == PAL)
+    {
+        const uint32_t offset = dst_ptr - pal_ram.data();
+        for(uint32_t i = 0; i < len; i += ARM_HALF_SIZE)
+        {
+            disp->update_pal_cache(offset + i);
+        }
+    }
+
+    write_count += cnt;
+
+    // charge every access in one go
+    const Access_type type = is_half? HALF : WORD;
+    const Memory_region src_region = read_pages[src >> PAGE_SHIFT].region;
+    mem_region = dst_region;
+    cpu->cycle_tick(cnt * (wait_states[src_region][type] + wait_states[mem_region][type]));
+
+    return true;
+}
+
+
+void Mem::mark_vram_dirty(uint32_t offset, uint32_t len)
+{
+    const uint32_t end = (offset + len - 1) >> VRAM_DIRTY_SHIFT;
+    for(uint32_t i = offset >> VRAM_DIRTY_SHIFT; i <= end; i++)
+    {
+        vram_dirty[i / 64] |= static_cast<uint64_t>(1) << (i % 64);
+    }
+}
+
+
+void Mem::mark_oam_dirty(uint32_t offset, uint32_t len)
+{
+    const uint32_t end = (offset + len - 1) >> 3;
+    for(uint32_t i = offset >> 3; i <= end; i++)
     {
-        puts("invalid bios size!");
-        exit(1);
+        oam_dirty[i / 64] |= static_cast<uint64_t>(1) << (i % 64);
+    }
+}
+
+
+void Mem::mark_code_page(uint32_t addr)
+{
+    switch((addr >> 24) & 0xf)
+    {
+        case 0x2:
+        {
+            const uint32_t page = (addr & 0x3ffff) >> CODE_PAGE_SHIFT;
+            if(!board_wram_code[page])
+            {
+                board_wram_code[page] = true;
+                update_wram_write_page(addr);
+            }
+            break;
+        }
+
+        case 0x3:
+        {
+            const uint32_t page = (addr & 0x7fff) >> CODE_PAGE_SHIFT;
+            if(!chip_wram_code[page])
+            {
+                chip_wram_code[page] = true;
+                update_wram_write_page(addr);
+            }
+            break;
+        }
+
+        // nothing else is writeable so dont bother tracking it
+        default: break;
+    }
+}
+
+// as if every page with code in it was written
+void Mem::drop_code_pages()
+{
+    for(uint32_t page = 0; page < board_wram_code.size(); page++)
+    {
+        if(board_wram_code[page])
+        {
+            const uint32_t addr = 0x02000000 | (page << CODE_PAGE_SHIFT);
+            board_wram_code[page] = false;
+            cpu->invalidate_blocks(addr);
+            update_wram_write_page(addr);
+        }
+    }
+
+    for(uint32_t page = 0; page < chip_wram_code.size(); page++)
+    {
+        if(chip_wram_code[page])
+        {
+            const uint32_t addr = 0x03000000 | (page << CODE_PAGE_SHIFT);
+            chip_wram_code[page] = false;
+            cpu->invalidate_blocks(addr);
+            update_wram_write_page(addr);
+        }
     }
 }
 
@@ -125,7 +452,7 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         {
             // first 3 bits read only
             // 6 and 7 are unused
-            io[addr] = v & ~0xc7;
+            io[addr] = (v & ~0xc7) | (io[addr] & 0x7);
             break;
         }
 
@@ -254,7 +581,7 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
 
 
 
-        // background 2 reference point registers
+        // background 2 / 3 reference point registers
         // on write these copy to internal regs
         case IO_BG2X_L:
         case IO_BG2X_L+1:
@@ -262,17 +589,25 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         case IO_BG2Y_L+1:
         case IO_BG2X_H:
         case IO_BG2Y_H:                        
+        case IO_BG3X_L:
+        case IO_BG3X_L+1:
+        case IO_BG3Y_L:
+        case IO_BG3Y_L+1:
+        case IO_BG3X_H:
+        case IO_BG3Y_H:                        
         {
             io[addr] = v;
-            disp->load_reference_point_regs();
+            disp->load_reference_point(addr);
             break;
         }
 
         case IO_BG2X_H+1:
         case IO_BG2Y_H+1:        
+        case IO_BG3X_H+1:
+        case IO_BG3Y_H+1:        
         {
             io[addr] = v & ~0xf0;
-            disp->load_reference_point_regs();
+            disp->load_reference_point(addr);
             break;
         }
 
@@ -334,14 +669,13 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         // dma 0 transfer control
         case IO_DMA0CNT_H+1:
         {
-            if(is_set(v,7) && !is_set(io[addr],7)) // transfer enabeld
+            const bool was_enabled = is_set(io[addr],7);
+            io[addr] = v;
+
+            if(is_set(v,7) && !was_enabled) // transfer enabeld
             {
-                cpu->dma_regs[0].src = handle_read<uint32_t>(io,IO_DMA0SAD);
-                cpu->dma_regs[0].dst = handle_read<uint32_t>(io,IO_DMA0DAD);
-                cpu->dma_regs[0].nn = handle_read<uint16_t>(io,IO_DMA0CNT_L);       
-                cpu->handle_dma(Dma_type::IMMEDIATE);
+                cpu->enable_dma(0);
             }
-            io[addr] = v;
             break;
         }
 
@@ -391,14 +725,13 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         // dma 1 transfer control
         case IO_DMA1CNT_H+1:
         {
-            if(is_set(v,7) && !is_set(io[addr],7)) // transfer enabeld
+            const bool was_enabled = is_set(io[addr],7);
+            io[addr] = v;
+
+            if(is_set(v,7) && !was_enabled) // transfer enabeld
             {
-                cpu->dma_regs[1].src = handle_read<uint32_t>(io,IO_DMA1SAD);
-                cpu->dma_regs[1].dst = handle_read<uint32_t>(io,IO_DMA1DAD);
-                cpu->dma_regs[1].nn = handle_read<uint16_t>(io,IO_DMA1CNT_L);   
-                cpu->handle_dma(Dma_type::IMMEDIATE);
+                cpu->enable_dma(1);
             }
-            io[addr] = v;
             break;
         }
 
@@ -444,14 +777,13 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         // dma 2 transfer control
         case IO_DMA2CNT_H+1:
         {
-            if(is_set(v,7) && !is_set(io[addr],7)) // transfer enabeld
+            const bool was_enabled = is_set(io[addr],7);
+            io[addr] = v;
+
+            if(is_set(v,7) && !was_enabled) // transfer enabeld
             {
-                cpu->dma_regs[2].src = handle_read<uint32_t>(io,IO_DMA2SAD);
-                cpu->dma_regs[2].dst = handle_read<uint32_t>(io,IO_DMA2DAD);
-                cpu->dma_regs[2].nn = handle_read<uint16_t>(io,IO_DMA2CNT_L);   
-                cpu->handle_dma(Dma_type::IMMEDIATE);
+                cpu->enable_dma(2);
             }
-            io[addr] = v;
             break;
         }
 
@@ -497,14 +829,13 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         // dma 3 transfer control
         case IO_DMA3CNT_H+1:
         {
-            if(is_set(v,7) && !is_set(io[addr],7)) // transfer enabeld
+            const bool was_enabled = is_set(io[addr],7);
+            io[addr] = v;
+
+            if(is_set(v,7) && !was_enabled) // transfer enabeld
             {
-                cpu->dma_regs[3].src = handle_read<uint32_t>(io,IO_DMA3SAD);
-                cpu->dma_regs[3].dst = handle_read<uint32_t>(io,IO_DMA3DAD);
-                cpu->dma_regs[3].nn = handle_read<uint16_t>(io,IO_DMA3CNT_L);                          
-                cpu->handle_dma(Dma_type::IMMEDIATE);
+                cpu->enable_dma(3);
             }
-            io[addr] = v;
             break;
         }
 
@@ -522,15 +853,11 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         // timer 0 control
         case IO_TM0CNT_H:
         {
-            if(is_set(v,7) && !is_set(io[addr],7))
-            {
-                // reload the timer
-                cpu->set_timer(0,handle_read<uint16_t>(io,IO_TM0CNT_L));
-                break;
-            }
+            const uint8_t old_cnt = io[addr];
             io[addr] = v;
+            cpu->write_timer_control(0,old_cnt);
             break;
-        } 
+        }
 
         // unused
         case IO_TM0CNT_H+1:
@@ -550,13 +877,11 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         // timer 1 control
         case IO_TM1CNT_H:
         {
-            if(is_set(v,7) && !is_set(io[addr],7))
-            {
-                cpu->set_timer(1,handle_read<uint16_t>(io,IO_TM1CNT_L));
-            }
+            const uint8_t old_cnt = io[addr];
             io[addr] = v;
+            cpu->write_timer_control(1,old_cnt);
             break;
-        } 
+        }
 
         // unused
         case IO_TM1CNT_H+1:
@@ -578,13 +903,11 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         // timer 2 control
         case IO_TM2CNT_H:
         {
-            if(is_set(v,7) && !is_set(io[addr],7))
-            {
-                cpu->set_timer(2,handle_read<uint16_t>(io,IO_TM2CNT_L));
-            }
+            const uint8_t old_cnt = io[addr];
             io[addr] = v;
+            cpu->write_timer_control(2,old_cnt);
             break;
-        } 
+        }
 
         // unused
         case IO_TM2CNT_H+1:
@@ -604,14 +927,11 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         // timer 3 control
         case IO_TM3CNT_H:
         {
-            if(is_set(v,7) && !is_set(io[addr],7))
-            {
-                //printf("enabled! %08x\n",cpu->get_pc());
-                cpu->set_timer(3,handle_read<uint16_t>(io,IO_TM3CNT_L));
-            }
+            const uint8_t old_cnt = io[addr];
             io[addr] = v;
+            cpu->write_timer_control(3,old_cnt);
             break;
-        } 
+        }
 
         // unused
         case IO_TM3CNT_H+1:
@@ -624,6 +944,7 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         case IO_IME: // 0th bit toggles ime
         {
             ime = is_set(v,0);
+            cpu->update_irq_pending();
             break;
         }
         case IO_IME + 1:
@@ -635,24 +956,28 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
         case IO_IE: // interrupt enable
         {
             io[addr] = v;
+            cpu->update_irq_pending();
             break;
         }
 
         case IO_IE+1:
         {
             io[addr] = v & ~0xc0;
+            cpu->update_irq_pending();
             break;
         }
 
         case IO_IF: // interrupt flag writing a 1 desets the bit
         {
             io[addr] &= ~v;
+            cpu->update_irq_pending();
             break;
         }
 
         case IO_IF+1:
         {
             io[addr] &= ~(v & ~0xc0);
+            cpu->update_irq_pending();
             break;
         }
 
@@ -691,6 +1016,15 @@ void Mem::write_io_regs(uint32_t addr,uint8_t v)
             break;
         }
 
+        // any write halts the cpu untill an interrupt is requested
+        // (stop mode is treated as a halt as nothing that can wake it is emulated)
+        case IO_HALTCNT:
+        {
+            io[addr] = v;
+            cpu->halt();
+            break;
+        }
+
 
 
         default:
@@ -956,9 +1290,7 @@ access_type Mem::handle_read(std::vector<uint8_t> &buf,uint32_t addr)
 #ifdef DEBUG // bounds check the memory access
     if(buf.size() < addr + sizeof(access_type))
     {
-        printf("out of range handle read at: %08x\n",cpu->get_pc());
-        cpu->print_regs();
-        exit(1);
+        throw Emu_error(fmt::format("out of range handle read at: {:08x}",cpu->get_pc()));
     }
 #endif
 
@@ -1001,6 +1333,15 @@ access_type Mem::read_mem(uint32_t addr)
     // handle address alignment
     addr &= ~(sizeof(access_type)-1);
 
+    // fast path for directly mapped memory
+    const Page &page = read_pages[addr >> PAGE_SHIFT];
+    if(page.ptr)
+    {
+        mem_region = page.region;
+        access_type v;
+        memcpy(&v,page.ptr + (addr & page.mask),sizeof(access_type));
+        return v;
+    }
 
     access_type v;
     if(addr < 0x00004000) v = read_bios<access_type>(addr);
@@ -1046,12 +1387,23 @@ void Mem::write_mem(uint32_t addr,access_type v)
 #endif
 
 
+    write_count++;
+
     // 28 bit bus
     addr &= 0x0fffffff;
 
     // handle address alignemt
     addr &= ~(sizeof(access_type)-1);
 
+    // fast path for directly mapped memory
+    const Page &page = write_pages[addr >> PAGE_SHIFT];
+    if(page.ptr)
+    {
+        mem_region = page.region;
+        memcpy(page.ptr + (addr & page.mask),&v,sizeof(access_type));
+        return;
+    }
+
     if(addr < 0x00004000) { mem_region = BIOS; return; } // bios is read only
     else if(addr < 0x02000000) { mem_region = UNDEFINED; return; }
     else if(addr < 0x03000000) write_board_wram<access_type>(addr,v);
@@ -1113,42 +1465,21 @@ void Mem::tick_mem_access<uint32_t>()
 template<typename access_type>
 access_type Mem::read_external(uint32_t addr)
 {
-
-    uint32_t len =  rom.size();
-    if((addr&0x1FFFFFF) > len)
-    {
-        printf("rom read out of range: %08x:%08x:%08x:%08x\n",addr&0x1FFFFFF,addr,len,cpu->get_pc());
-        cpu->print_regs();
-        exit(1);
-    }
-
+    // rom reads normally go through the page table
+    // but its padded out to 32mb so its allways safe to read here too
     switch((addr >> 24) & 0xf)
     {
         case 0x8: // wait state 0
         case 0x9:
-        {
-            mem_region = ROM;
-            //return rom[addr - 0x08000000];
-            return handle_read<access_type>(rom,addr&0x1FFFFFF);
-            break;
-        }
-
         case 0xa: // wait state 1
         case 0xb:
-        {
-            mem_region = ROM;
-            //return rom[addr - 0x0a000000];
-            return handle_read<access_type>(rom,addr&0x1FFFFFF);
-            break;
-        }
-            
         case 0xc: // wait state 2
         case 0xd:
         {
             mem_region = ROM;
-            //return rom[addr - 0x0c000000];
-            return handle_read<access_type>(rom,addr&0x1FFFFFF);
-            break;
+            access_type v;
+            memcpy(&v,&rom[addr & (ROM_MAX_SIZE - 1)],sizeof(access_type));
+            return v;
         }
 
         case 0xe: // sram
@@ -1194,9 +1525,7 @@ access_type Mem::read_external(uint32_t addr)
             }
         }
     }
-    printf("read_external fell through %08x\n",addr);
-    cpu->print_regs();
-    exit(1);    
+    throw Emu_error(fmt::format("read_external fell through {:08x}",addr));
 }
 
 
@@ -1342,9 +1671,7 @@ void Mem::write_external(uint32_t addr,access_type v)
         }
 
     }
-    printf("write_external fell through %08x:%08x\n",addr,cpu->get_pc());
-    cpu->print_regs();
-    exit(1);    
+    throw Emu_error(fmt::format("write_external fell through {:08x}:{:08x}",addr,cpu->get_pc()));
 }
 
 //access handler for reads (for non io mapped mem)
@@ -1356,9 +1683,7 @@ void Mem::handle_write(std::vector<uint8_t> &buf,uint32_t addr,access_type v)
 #ifdef DEBUG // bounds check the memory access
     if(buf.size() < addr + sizeof(access_type))
     {
-        printf("out of range handle write at: %08x\n",cpu->get_pc());
-        cpu->print_regs();
-        exit(1);
+        throw Emu_error(fmt::format("out of range handle write at: {:08x}",cpu->get_pc()));
     }
 #endif
 
@@ -1413,6 +1738,7 @@ void Mem::write_oam(uint32_t addr,access_type v)
     mem_region = OAM;
     //oam[addr & 0x3ff] = v;
     handle_write<access_type>(oam,addr&0x3ff,v);
+    mark_oam_dirty(addr&0x3ff,sizeof(access_type));
 }
 
 template<typename access_type>
@@ -1421,6 +1747,7 @@ void Mem::write_vram(uint32_t addr,access_type v)
     mem_region = VRAM;
     //vram[addr-0x06000000] = v;
     handle_write<access_type>(vram,addr-0x06000000,v); 
+    mark_vram_dirty(addr-0x06000000,sizeof(access_type));
 }
 
 template<typename access_type>
@@ -1429,12 +1756,27 @@ void Mem::write_pal_ram(uint32_t addr,access_type v)
     mem_region = PAL;
     //pal_ram[addr & 0x3ff] = v;
     handle_write<access_type>(pal_ram,addr&0x3ff,v);
+
+    for(uint32_t i = 0; i < sizeof(access_type); i += 2)
+    {
+        disp->update_pal_cache((addr + i) & 0x3ff);
+    }
 }
 
 template<typename access_type>
 void Mem::write_board_wram(uint32_t addr,access_type v)
 {
     mem_region = WRAM_BOARD;
+
+    // writing over cached code
+    const uint32_t page = (addr & 0x3ffff) >> CODE_PAGE_SHIFT;
+    if(board_wram_code[page])
+    {
+        board_wram_code[page] = false;
+        cpu->invalidate_blocks(0x02000000 | (page << CODE_PAGE_SHIFT));
+        update_wram_write_page(addr);
+    }
+
     //return board_wram[addr & 0x3ffff] = v;
     handle_write<access_type>(board_wram,addr&0x3ffff,v);
 }
@@ -1443,6 +1785,16 @@ template<typename access_type>
 void Mem::write_chip_wram(uint32_t addr,access_type v)
 {
     mem_region = WRAM_CHIP;
+
+    // writing over cached code
+    const uint32_t page = (addr & 0x7fff) >> CODE_PAGE_SHIFT;
+    if(chip_wram_code[page])
+    {
+        chip_wram_code[page] = false;
+        cpu->invalidate_blocks(0x03000000 | (page << CODE_PAGE_SHIFT));
+        update_wram_write_page(addr);
+    }
+
     //chip_wram[addr & 0x7fff] = v;
     handle_write<access_type>(chip_wram,addr&0x7fff,v);
 }
\ No newline at end of file
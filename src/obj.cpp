@@ -0,0 +1,252 @@
+#include "headers/display.h"
+#include "headers/memory.h"
+
+
+// width, height for each shape and size
+static constexpr int obj_size_table[4][4][2] =
+{
+    {{8,8},{16,16},{32,32},{64,64}}, // square
+    {{16,8},{32,8},{32,16},{64,32}}, // horizontal
+    {{8,16},{8,32},{16,32},{32,64}}, // vertical
+    {{8,8},{8,8},{8,8},{8,8}} // prohibited
+};
+
+// cycles a line has to draw sprites in
+static constexpr int OBJ_LINE_CYCLES = 1210;
+static constexpr int OBJ_LINE_CYCLES_HBLANK_FREE = 954;
+
+// obj tiles start after the bg ones
+static constexpr uint32_t OBJ_TILE_BASE = 0x10000;
+
+
+// add or remove a sprite from the lists of every line it covers
+void Display::set_obj_lines(int idx, bool visible)
+{
+    const Obj &obj = objs[idx];
+    const uint64_t bit = static_cast<uint64_t>(1) << (idx % 64);
+
+    for(int i = 0; i < obj.bound_height; i++)
+    {
+        // sprites wrap round the bottom of the screen
+        const int line = (obj.y + i) & 0xff;
+        if(line < Y)
+        {
+            line_objs[line][idx / 64] = visible? line_objs[line][idx / 64] | bit : line_objs[line][idx / 64] & ~bit;
+        }
+    }
+}
+
+void Display::parse_obj(int idx)
+{
+    Obj &obj = objs[idx];
+
+    // take it off the lines it used to be on
+    set_obj_lines(idx,false);
+
+    const uint16_t attr0 = mem->handle_read<uint16_t>(mem->oam,idx*8);
+    const uint16_t attr1 = mem->handle_read<uint16_t>(mem->oam,(idx*8)+2);
+    const uint16_t attr2 = mem->handle_read<uint16_t>(mem->oam,(idx*8)+4);
+
+    obj.affine = is_set(attr0,8);
+    obj.col_256 = is_set(attr0,13);
+
+    // bit 9 is the double size flag for affine sprites
+    // and disables regular ones, obj window sprites are not emulated
+    const bool double_size = obj.affine && is_set(attr0,9);
+    const bool disabled = !obj.affine && is_set(attr0,9);
+    const int obj_mode = (attr0 >> 10) & 0x3;
+
+    const int shape = (attr0 >> 14) & 0x3;
+    const int size = (attr1 >> 14) & 0x3;
+    obj.width = obj_size_table[shape][size][0];
+    obj.height = obj_size_table[shape][size][1];
+    obj.bound_width = double_size? obj.width * 2 : obj.width;
+    obj.bound_height = double_size? obj.height * 2 : obj.height;
+
+    obj.y = attr0 & 0xff;
+    obj.x = sign_extend(attr1 & 0x1ff,9);
+
+    obj.affine_group = (attr1 >> 9) & 0x1f;
+    obj.x_flip = is_set(attr1,12);
+    obj.y_flip = is_set(attr1,13);
+
+    obj.tile_num = attr2 & 0x3ff;
+    obj.priority = (attr2 >> 10) & 0x3;
+    obj.pal_num = (attr2 >> 12) & 0xf;
+
+    if(!disabled && obj_mode < 2)
+    {
+        set_obj_lines(idx,true);
+    }
+}
+
+// reparse any entries written since last time
+void Display::parse_oam()
+{
+    for(int i = 0; i < 2; i++)
+    {
+        uint64_t dirty = mem->oam_dirty[i];
+        mem->oam_dirty[i] = 0;
+
+        for(int idx = i * 64; dirty; idx++, dirty >>= 1)
+        {
+            if(dirty & 1)
+            {
+                parse_obj(idx);
+            }
+        }
+    }
+}
+
+
+// draw a pixel if nothing in front of it has been drawn there yet
+// sprites are drawn in oam order so on a priority tie the first one stays
+void Display::draw_obj_pixel(int x, uint32_t color, uint32_t priority)
+{
+    if(color && priority < obj_prio[x])
+    {
+        if(obj_prio[x] != 4)
+        {
+            obj_line[obj_prio[x]][x] = 0;
+        }
+
+        obj_line[priority][x] = color;
+        obj_prio[x] = priority;
+    }
+}
+
+
+void Display::render_obj(const Obj &obj, bool map_1d)
+{
+    // line inside the sprites bounding box
+    const int obj_y = (ly - obj.y) & 0xff;
+
+    const uint32_t *pal = obj.col_256? &pal_cache[256] : &pal_cache[256 + (obj.pal_num * 16)];
+
+    // 256 color tiles take two tile numbers
+    // 2d mapping lays tiles out in a 32 tile wide grid
+    // 1d mapping packs each sprite's rows one after another
+    const uint32_t tile_step = obj.col_256? 2 : 1;
+    const uint32_t row_step = map_1d? (obj.width / 8) * tile_step : 32;
+
+    if(!obj.affine)
+    {
+        const int ty = obj.y_flip? obj.height - 1 - obj_y : obj_y;
+        const uint32_t row_tile = obj.tile_num + ((ty / 8) * row_step);
+
+        uint32_t tile_data[8];
+        for(int col = 0; col < obj.width / 8; col++)
+        {
+            const int x_start = obj.x + (col * 8);
+            if(x_start + 8 <= 0 || x_start >= X)
+            {
+                continue;
+            }
+
+            const int tile_col = obj.x_flip? (obj.width / 8) - 1 - col : col;
+            const uint32_t tile = (row_tile + (tile_col * tile_step)) & 0x3ff;
+            const uint8_t *row = get_tile(OBJ_TILE_BASE + (tile * 0x20),obj.col_256) + ((ty % 8) * 8);
+
+            line_ops.expand_row(tile_data,row,pal,obj.x_flip);
+
+            for(int i = 0; i < 8; i++)
+            {
+                const int x = x_start + i;
+                if(x >= 0 && x < X)
+                {
+                    draw_obj_pixel(x,tile_data[i],obj.priority);
+                }
+            }
+        }
+    }
+
+    else
+    {
+        // the 4 params for a group are spread over the attr3 of 4 entries
+        const uint32_t param_base = (obj.affine_group * 0x20) + 6;
+        const int32_t pa = static_cast<int16_t>(mem->handle_read<uint16_t>(mem->oam,param_base));
+        const int32_t pb = static_cast<int16_t>(mem->handle_read<uint16_t>(mem->oam,param_base + 8));
+        const int32_t pc = static_cast<int16_t>(mem->handle_read<uint16_t>(mem->oam,param_base + 16));
+        const int32_t pd = static_cast<int16_t>(mem->handle_read<uint16_t>(mem->oam,param_base + 24));
+
+        // rotation is around the middle of the bounding box
+        const int dy = obj_y - (obj.bound_height / 2);
+
+        for(int px = 0; px < obj.bound_width; px++)
+        {
+            const int x = obj.x + px;
+            if(x < 0)
+            {
+                continue;
+            }
+
+            if(x >= X)
+            {
+                break;
+            }
+
+            const int dx = px - (obj.bound_width / 2);
+            const int tx = ((pa * dx + pb * dy) >> 8) + (obj.width / 2);
+            const int ty = ((pc * dx + pd * dy) >> 8) + (obj.height / 2);
+
+            if(tx < 0 || tx >= obj.width || ty < 0 || ty >= obj.height)
+            {
+                continue;
+            }
+
+            const uint32_t tile = (obj.tile_num + ((ty / 8) * row_step) + ((tx / 8) * tile_step)) & 0x3ff;
+            const uint8_t idx = get_tile(OBJ_TILE_BASE + (tile * 0x20),obj.col_256)[((ty % 8) * 8) + (tx % 8)];
+
+            if(idx)
+            {
+                draw_obj_pixel(x,pal[idx],obj.priority);
+            }
+        }
+    }
+}
+
+
+void Display::render_objs(uint16_t dispcnt)
+{
+    parse_oam();
+
+    memset(obj_line,0,sizeof(obj_line));
+    memset(obj_prio,4,sizeof(obj_prio));
+
+    const bool map_1d = is_set(dispcnt,6);
+
+    // bitmap modes use the lower half of obj vram
+    const bool bitmap_mode = (dispcnt & 0x7) >= 3;
+
+    int cycles = is_set(dispcnt,5)? OBJ_LINE_CYCLES_HBLANK_FREE : OBJ_LINE_CYCLES;
+
+    for(int i = 0; i < 2; i++)
+    {
+        uint64_t visible = line_objs[ly][i];
+
+        for(int idx = i * 64; visible; idx++, visible >>= 1)
+        {
+            if(!(visible & 1))
+            {
+                continue;
+            }
+
+            const Obj &obj = objs[idx];
+
+            // out of time to draw any more on this line
+            const int cost = obj.affine? 10 + (obj.bound_width * 2) : obj.width;
+            if(cost > cycles)
+            {
+                return;
+            }
+            cycles -= cost;
+
+            if(bitmap_mode && obj.tile_num < 512)
+            {
+                continue;
+            }
+
+            render_obj(obj,map_1d);
+        }
+    }
+}
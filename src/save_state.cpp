@@ -0,0 +1,234 @@
+#include "headers/gba.h"
+#include <memory>
+
+
+static constexpr char SAVE_STATE_MAGIC[4] = {'G','B','A','S'};
+
+
+void Cpu::save_state(Cpu_state &state)
+{
+    // flags might only be recorded as the last alu op
+    calc_flags();
+
+    memcpy(state.regs,regs,sizeof(regs));
+    state.cpsr = cpsr;
+    memcpy(state.banked_regs,banked_regs,sizeof(banked_regs));
+    memcpy(state.status_banked,status_banked,sizeof(status_banked));
+    memcpy(state.pipeline,pipeline,sizeof(pipeline));
+    state.cpu_mode = cpu_mode;
+    state.cyc_cnt = cyc_cnt;
+
+    state.is_thumb = is_thumb;
+    state.halted = halted;
+    state.intr_waiting = intr_waiting;
+
+    memcpy(state.dma_regs,dma_regs,sizeof(dma_regs));
+    state.dma_running = dma_running;
+
+    memcpy(state.timers,timers,sizeof(timers));
+}
+
+// memory has to be loaded first as the irq state is worked out from io
+void Cpu::load_state(const Cpu_state &state)
+{
+    memcpy(regs,state.regs,sizeof(regs));
+    cpsr = state.cpsr;
+    memcpy(banked_regs,state.banked_regs,sizeof(banked_regs));
+    memcpy(status_banked,state.status_banked,sizeof(status_banked));
+    memcpy(pipeline,state.pipeline,sizeof(pipeline));
+    cpu_mode = static_cast<Cpu_mode>(state.cpu_mode);
+    cyc_cnt = state.cyc_cnt;
+
+    is_thumb = state.is_thumb;
+    halted = state.halted;
+    intr_waiting = state.intr_waiting;
+
+    memcpy(dma_regs,state.dma_regs,sizeof(dma_regs));
+    dma_running = state.dma_running;
+
+    memcpy(timers,state.timers,sizeof(timers));
+
+    flag_op = Flag_op::NONE;
+
+    // anything we were tracking about where we were is now wrong
+    arm_block_cache.cur = nullptr;
+    thumb_block_cache.cur = nullptr;
+    jit_seq_pc = 0xffffffff;
+    idle_loop_pc = 0xffffffff;
+    idle_timer_read = false;
+
+    update_irq_pending();
+}
+
+
+void Mem::save_state(Mem_state &state) const
+{
+    memcpy(state.board_wram,board_wram.data(),sizeof(state.board_wram));
+    memcpy(state.chip_wram,chip_wram.data(),sizeof(state.chip_wram));
+    memcpy(state.io,io.data(),sizeof(state.io));
+    memcpy(state.pal_ram,pal_ram.data(),sizeof(state.pal_ram));
+    memcpy(state.vram,vram.data(),sizeof(state.vram));
+    memcpy(state.oam,oam.data(),sizeof(state.oam));
+    memcpy(state.sram,sram.data(),sizeof(state.sram));
+
+    memcpy(state.wait_states,wait_states,sizeof(wait_states));
+    state.mem_region = mem_region;
+    state.write_count = write_count;
+    state.ime = ime;
+}
+
+void Mem::load_state(const Mem_state &state)
+{
+    // the buffers are copied into rather than replaced
+    // as the page tables point straight at them
+    memcpy(board_wram.data(),state.board_wram,sizeof(state.board_wram));
+    memcpy(chip_wram.data(),state.chip_wram,sizeof(state.chip_wram));
+    memcpy(io.data(),state.io,sizeof(state.io));
+    memcpy(pal_ram.data(),state.pal_ram,sizeof(state.pal_ram));
+    memcpy(vram.data(),state.vram,sizeof(state.vram));
+    memcpy(oam.data(),state.oam,sizeof(state.oam));
+    memcpy(sram.data(),state.sram,sizeof(state.sram));
+
+    memcpy(wait_states,state.wait_states,sizeof(wait_states));
+    mem_region = state.mem_region;
+    write_count = state.write_count;
+    ime = state.ime;
+
+    // treat everything as freshly written so the caches get rebuilt
+    drop_code_pages();
+    mark_vram_dirty(0,VRAM_SIZE);
+    mark_oam_dirty(0,OAM_SIZE);
+
+    for(uint32_t addr = 0; addr < PAL_RAM_SIZE; addr += ARM_HALF_SIZE)
+    {
+        disp->update_pal_cache(addr);
+    }
+}
+
+
+void Display::save_state(Display_state &state) const
+{
+    memcpy(state.screen,screen,sizeof(screen));
+    memcpy(state.ref_x,ref_x,sizeof(ref_x));
+    memcpy(state.ref_y,ref_y,sizeof(ref_y));
+    state.ly = ly;
+    state.mode = mode;
+    state.new_vblank = new_vblank;
+}
+
+void Display::load_state(const Display_state &state)
+{
+    memcpy(screen,state.screen,sizeof(screen));
+    memcpy(ref_x,state.ref_x,sizeof(ref_x));
+    memcpy(ref_y,state.ref_y,sizeof(ref_y));
+    ly = state.ly;
+    mode = state.mode;
+    new_vblank = state.new_vblank;
+}
+
+
+void Scheduler::save_state(Scheduler_state &state) const
+{
+    state.timestamp = timestamp;
+    memcpy(state.timestamps,timestamps,sizeof(timestamps));
+    memcpy(state.active,active,sizeof(active));
+}
+
+void Scheduler::load_state(const Scheduler_state &state)
+{
+    timestamp = state.timestamp;
+    memcpy(timestamps,state.timestamps,sizeof(timestamps));
+    memcpy(active,state.active,sizeof(active));
+    update_min_timestamp();
+}
+
+
+void GBA::save_state(Save_state &state)
+{
+    memcpy(state.magic,SAVE_STATE_MAGIC,sizeof(state.magic));
+    state.version = Save_state::VERSION;
+    state.size = sizeof(Save_state);
+    state.rom_size = mem.get_rom_size();
+
+    cpu.save_state(state.cpu);
+    mem.save_state(state.mem);
+    disp.save_state(state.disp);
+    scheduler.save_state(state.scheduler);
+}
+
+bool GBA::load_state(const Save_state &state)
+{
+    if(memcmp(state.magic,SAVE_STATE_MAGIC,sizeof(state.magic)) != 0)
+    {
+        puts("not a save state");
+        return false;
+    }
+
+    if(state.version != Save_state::VERSION || state.size != sizeof(Save_state))
+    {
+        printf("save state is version %u but this build uses version %u\n",state.version,Save_state::VERSION);
+        return false;
+    }
+
+    if(state.rom_size != mem.get_rom_size())
+    {
+        puts("save state is for a different rom");
+        return false;
+    }
+
+    mem.load_state(state.mem);
+    cpu.load_state(state.cpu);
+    disp.load_state(state.disp);
+    scheduler.load_state(state.scheduler);
+
+    return true;
+}
+
+
+bool GBA::save_state_file(const std::string &filename)
+{
+    // zeroed so the padding in the file is allways the same
+    auto state = std::make_unique<Save_state>();
+    save_state(*state);
+
+    FILE *fp = fopen(filename.c_str(),"wb");
+    if(!fp)
+    {
+        printf("unable to open %s\n",filename.c_str());
+        return false;
+    }
+
+    const bool ok = fwrite(state.get(),sizeof(Save_state),1,fp) == 1;
+    fclose(fp);
+
+    if(!ok)
+    {
+        printf("failed to write save state %s\n",filename.c_str());
+    }
+    return ok;
+}
+
+bool GBA::load_state_file(const std::string &filename)
+{
+    auto state = std::make_unique<Save_state>();
+
+    FILE *fp = fopen(filename.c_str(),"rb");
+    if(!fp)
+    {
+        printf("unable to open %s\n",filename.c_str());
+        return false;
+    }
+
+    const size_t len = fread(state.get(),1,sizeof(Save_state),fp);
+    fclose(fp);
+
+    // states from other versions can be a different size
+    // so leave those for the header check to report
+    if(len != sizeof(Save_state) && state->version == Save_state::VERSION)
+    {
+        printf("save state %s is truncated\n",filename.c_str());
+        return false;
+    }
+
+    return load_state(*state);
+}
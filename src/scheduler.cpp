@@ -0,0 +1,117 @@
+#include "headers/scheduler.h"
+#include "headers/cpu.h"
+#include "headers/display.h"
+
+
+void Scheduler::init(Cpu *cpu, Display *disp)
+{
+    this->cpu = cpu;
+    this->disp = disp;
+
+    timestamp = 0;
+    for(int i = 0; i < EVENT_SIZE; i++)
+    {
+        timestamps[i] = 0;
+        active[i] = false;
+    }
+    update_min_timestamp();
+}
+
+
+void Scheduler::insert(Gba_event event, uint64_t cycles)
+{
+    const int idx = static_cast<int>(event);
+    timestamps[idx] = timestamp + cycles;
+    active[idx] = true;
+    update_min_timestamp();
+}
+
+void Scheduler::insert_relative(Gba_event event, uint64_t cycles)
+{
+    const int idx = static_cast<int>(event);
+    timestamps[idx] += cycles;
+    active[idx] = true;
+    update_min_timestamp();
+}
+
+void Scheduler::remove(Gba_event event)
+{
+    active[static_cast<int>(event)] = false;
+    update_min_timestamp();
+}
+
+// only a handful of events so a linear scan is fine
+void Scheduler::update_min_timestamp()
+{
+    min_timestamp = std::numeric_limits<uint64_t>::max();
+
+    for(int i = 0; i < EVENT_SIZE; i++)
+    {
+        if(active[i] && timestamps[i] < min_timestamp)
+        {
+            min_timestamp = timestamps[i];
+        }
+    }
+}
+
+
+void Scheduler::service_events()
+{
+    // handlers may schedule events that are allready due
+    // so keep going untill everything up to now is handled
+    while(timestamp >= min_timestamp)
+    {
+        // find the earliest due event
+        // (something must be active to get here)
+        int idx = 0;
+        for(int i = 0; i < EVENT_SIZE; i++)
+        {
+            if(active[i] && timestamps[i] == min_timestamp)
+            {
+                idx = i;
+                break;
+            }
+        }
+
+        active[idx] = false;
+        events_serviced++;
+        service_event(static_cast<Gba_event>(idx));
+        update_min_timestamp();
+    }
+}
+
+
+void Scheduler::service_event(Gba_event event)
+{
+    switch(event)
+    {
+        case Gba_event::DISPLAY:
+        {
+            disp->tick();
+            break;
+        }
+
+        case Gba_event::TIMER0:
+        case Gba_event::TIMER1:
+        case Gba_event::TIMER2:
+        case Gba_event::TIMER3:
+        {
+            cpu->timer_event(static_cast<int>(event) - static_cast<int>(Gba_event::TIMER0));
+            break;
+        }
+
+        case Gba_event::DMA0:
+        case Gba_event::DMA1:
+        case Gba_event::DMA2:
+        case Gba_event::DMA3:
+        {
+            cpu->dma_event(static_cast<int>(event) - static_cast<int>(Gba_event::DMA0));
+            break;
+        }
+
+        case Gba_event::SIZE:
+        {
+            throw Emu_error("scheduler: invalid event!");
+        }
+    }
+}
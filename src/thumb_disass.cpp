@@ -290,8 +290,7 @@ std::string Disass::disass_thumb_ldst_imm(uint16_t opcode)
             break;
         }
     }
-    puts("disass_thumb_ldst_imm fell through!?");
-    exit(1);
+    throw Emu_error("disass_thumb_ldst_imm fell through!?");
 }
 
 // hi reg ops/branch exchange
@@ -336,8 +335,7 @@ std::string Disass::disass_thumb_hi_reg_ops(uint16_t opcode)
             break;
         }
     }
-    puts("disass_thumb_hi_reg_ops fell through!?");
-    exit(1);
+    throw Emu_error("disass_thumb_hi_reg_ops fell through!?");
 }
 
 std::string Disass::disass_thumb_push_pop(uint16_t opcode)
@@ -448,8 +446,7 @@ std::string Disass::disass_thumb_add_sub(uint16_t opcode)
                 user_regs_names[rs],rn);
         }        
     }
-    puts("disass_thumb_add_sub fell though!?");
-    exit(1);
+    throw Emu_error("disass_thumb_add_sub fell though!?");
 }
 
 std::string Disass::disass_thumb_alu(uint16_t opcode)
@@ -543,7 +540,5 @@ std::string Disass::disass_thumb_cond_branch(uint16_t opcode)
 std::string Disass::disass_thumb_unknown(uint16_t opcode)
 {
     uint8_t op = get_thumb_opcode_bits(opcode);
-    printf("[disass-thumb]%08x:unknown opcode %04x:%x\n",pc,opcode,op);
-    cpu->print_regs();
-    exit(1);   
+    throw Emu_error(fmt::format("[disass-thumb]{:08x}:unknown opcode {:04x}:{:x}",pc,opcode,op));
 }
\ No newline at end of file
@@ -4,15 +4,6 @@
 #include "headers/disass.h"
 
 
-uint16_t Cpu::fetch_thumb_opcode()
-{
-    // ignore the pipeline for now
-    regs[PC] &= ~1;
-    uint16_t opcode = mem->read_memt<uint16_t>(regs[PC]);
-    regs[PC] += ARM_HALF_SIZE;
-    return opcode;
-}
-
 void Cpu::exec_thumb()
 {
 #ifdef DEBUG
@@ -23,15 +14,19 @@ void Cpu::exec_thumb()
     }
 #endif
     
-    uint16_t op = fetch_thumb_opcode();
+    // ignore the pipeline for now
+    regs[PC] &= ~1;
+
+    const Thumb_block_instr instr = fetch_thumb_opcode();
 
-    execute_thumb_opcode(op);
+    // handler is allready decoded
+    std::invoke(instr.handler,this,instr.opcode);
 }
 
 void Cpu::execute_thumb_opcode(uint16_t instr)
 {
     // get the bits that determine the kind of instr it is
-    uint8_t op = (instr >> 8) & 0xff;
+    uint16_t op = get_thumb_exec_bits(instr);
 
     // call the function from our opcode table
     std::invoke(thumb_opcode_table[op],this,instr);    
@@ -39,20 +34,164 @@ void Cpu::execute_thumb_opcode(uint16_t instr)
 
 
 
+// work out the handler for a set of decode bits
+// (bits 15-6 of the opcode)
+// the hot handlers get the fields they switch on as template params
+template<const int j>
+constexpr Cpu::THUMB_OPCODE_FPTR Cpu::get_thumb_handler()
+{
+    // top 8 bits are enough to tell the instrs apart
+    constexpr int i = j >> 2;
+
+     // THUMB.11: load/store SP-relative
+    if constexpr(((i >> 4) & 0b1111) == 0b1001)
+    {
+        return &Cpu::thumb_load_store_sp<is_set(j,5)>;
+    }
+
+    // THUMB.13: add offset to stack pointer
+    else if constexpr(i == 0b10110000)
+    {
+        return &Cpu::thumb_sp_add;
+    }
+
+    // THUMB.17: software interrupt and breakpoint
+    else if constexpr(i  == 0b11011111)
+    {
+        return &Cpu::thumb_swi;
+    }
+
+    // THUMB.8: load/store sign-extended byte/halfword
+    else if constexpr(((i >> 4) & 0b1111) == 0b0101 && is_set(i,1))
+    {
+        return &Cpu::thumb_load_store_sbh<(j >> 4) & 0x3>;
+    }
+
+    // THUMB.7: load/store with register offset
+    else if constexpr(((i >> 4) & 0b1111) == 0b0101 && !is_set(i,1))
+    {
+        return &Cpu::thumb_load_store_reg<(j >> 4) & 0x3>;
+    }
+
+    // THUMB.12: get relative address
+    else if constexpr(((i >> 4) & 0b1111) == 0b1010)
+    {
+        return &Cpu::thumb_get_rel_addr;
+    }
+    
+    // THUMB.18: unconditional branch
+    else if constexpr(((i >> 3) & 0b11111) == 0b11100)
+    {
+        return &Cpu::thumb_branch;
+    }
+
+    //THUMB.10: load/store halfword
+    else if constexpr(((i >> 4) & 0b1111) == 0b1000)
+    {
+        return &Cpu::thumb_load_store_half<is_set(j,5)>;
+    }
+
+    //THUMB.14: push/pop registers
+    else if constexpr(((i >> 4) & 0b1111) == 0b1011 
+        && ((i >> 1) & 0b11) == 0b10)
+    {
+        return &Cpu::thumb_push_pop<is_set(j,5)>;
+    }
+
+    // THUMB.9: load/store with immediate offset
+    else if constexpr(((i>>5) & 0b111) == 0b011)
+    {
+        return &Cpu::thumb_ldst_imm<(j >> 5) & 0x3>;
+    }
+
+
+    // THUMB.5: Hi register operations/branch exchange
+    else if constexpr(((i >> 2) & 0b111111) == 0b010001)
+    {
+        return &Cpu::thumb_hi_reg_ops<(j >> 2) & 0x3>;
+    }
+
+    //  THUMB.15: multiple load/store
+    else if constexpr(((i >> 4) & 0b1111) == 0b1100)
+    {
+        return &Cpu::thumb_multiple_load_store<is_set(j,5)>;
+    }
+
+    // THUMB.2: add/subtract
+    else if constexpr(((i >> 3) & 0b11111) == 0b00011)
+    {
+        return &Cpu::thumb_add_sub<(j >> 3) & 0x3>;
+    }
+
+    // THUMB.4: ALU operations
+    else if constexpr(((i >> 2) & 0b111111) == 0b010000)
+    {
+        return &Cpu::thumb_alu<j & 0xf>;
+    }
+
+    // THUMB.19: long branch with link
+    else if constexpr(((i >> 4) & 0b1111) == 0b1111)
+    {
+        return &Cpu::thumb_long_bl<!is_set(j,5)>;
+    }
+
+    // THUMB.6: load PC-relative
+    else if constexpr(((i >> 3) & 0b11111) ==  0b01001)
+    {
+        return &Cpu::thumb_ldr_pc;
+    }
+
+    // THUMB.3: move/compare/add/subtract immediate
+    else if constexpr(((i >> 5) & 0b111) == 0b001)
+    {
+        return &Cpu::thumb_mcas_imm<(j >> 5) & 0x3>;
+    }
+
+    // THUMB.1: move shifted register
+    // top 3 bits unset
+    else if constexpr(((i >> 5) & 0b111) == 0b000)
+    {
+        return &Cpu::thumb_mov_reg_shift<(j >> 5) & 0x3>;
+    }
+
+    // THUMB.16: conditional branch
+    else if constexpr(((i >> 4)  & 0b1111) == 0b1101)
+    {
+        return &Cpu::thumb_cond_branch<i & 0xf>;
+    }
+
+    else 
+    {
+        return &Cpu::thumb_unknown;
+    }                 
+}
+
+template<size_t... I>
+constexpr std::array<Cpu::THUMB_OPCODE_FPTR,sizeof...(I)> Cpu::gen_thumb_opcode_table(std::index_sequence<I...>)
+{
+    return {get_thumb_handler<I>()...};
+}
+
+void Cpu::init_thumb_opcode_table()
+{
+    constexpr auto table = gen_thumb_opcode_table(std::make_index_sequence<1024>{});
+    thumb_opcode_table.assign(table.begin(),table.end());
+}
+
+
 void Cpu::thumb_unknown(uint16_t opcode)
 {
     uint8_t op = get_thumb_opcode_bits(opcode);
-    printf("[cpu-thumb]unknown opcode %04x:%x\n",opcode,op);
-    print_regs();
-    exit(1);
+    throw Emu_error(fmt::format("[cpu-thumb]unknown opcode {:04x}:{:x}",opcode,op));
 }
 
 
+template<const bool L>
 void Cpu::thumb_load_store_sp(uint16_t opcode)
 {
     uint32_t nn = (opcode & 0xff) * 4;
     int rd = (opcode >> 8) & 0x7;
-    bool l = is_set(opcode,11);
+    constexpr bool l = L;
 
     uint32_t addr = regs[SP] + nn;
 
@@ -82,33 +221,15 @@ void Cpu::thumb_sp_add(uint16_t opcode)
     cycle_tick(1); // 1 s cycle    
 }
 
-// start here
-// software interrupt (figure out interrupt vectors and what damb mode it swaps too)
-// ^ not sure im reading from the right place for the vector table
 void Cpu::thumb_swi(uint16_t opcode)
 {
-    // do we even do anything with nn!?
-    UNUSED(opcode);
     //printf("[thumb-swi: %08x] %x\n",regs[PC],opcode & 0xff);
+    if(hle_swi(opcode & 0xff,regs[PC] - ARM_HALF_SIZE))
+    {
+        return;
+    }
 
-    // spsr for supervisor = cpsr
-    status_banked[SUPERVISOR] = cpsr;
-
-    // lr in supervisor mode set to return addr
-    hi_banked[SUPERVISOR][1] = regs[PC];
-
-    // supervisor mode switch
-    switch_mode(SUPERVISOR);
-
-    
-    // switch to arm mode
-    is_thumb = false; // switch to arm mode
-    cpsr = deset_bit(cpsr,5); // toggle thumb in cpsr
-    cpsr = set_bit(cpsr,7); //set the irq bit to mask interrupts
-
-    // branch to interrupt vector
-    regs[PC] = 0x8;
-    cycle_tick(3); // 2s + 1n;
+    enter_swi();
 }
 
 void Cpu::thumb_get_rel_addr(uint16_t opcode)
@@ -129,16 +250,16 @@ void Cpu::thumb_get_rel_addr(uint16_t opcode)
     cycle_tick(1); // 1 s cycle
 }
 
+template<const int OP>
 void Cpu::thumb_load_store_sbh(uint16_t opcode)
 {
     int ro = (opcode >> 6) & 0x7;
     int rb = (opcode >> 3) & 0x7;
     int rd = opcode & 0x7;
-    int op = (opcode >> 10) & 0x3;
-
+    
     uint32_t addr = regs[rb] + regs[ro];
 
-    switch(op)
+    switch(OP)
     {
         case 0: // strh
         {
@@ -170,9 +291,9 @@ void Cpu::thumb_load_store_sbh(uint16_t opcode)
     }
 }
 
+template<const int OP>
 void Cpu::thumb_load_store_reg(uint16_t opcode)
 {
-    int op = (opcode >> 10) & 0x3;
     int ro = (opcode >> 6) & 0x7;
     int rb = (opcode >> 3) & 0x7;
     int rd = opcode & 0x7;
@@ -180,7 +301,7 @@ void Cpu::thumb_load_store_reg(uint16_t opcode)
 
     uint32_t addr = regs[rb] + regs[ro];
 
-    switch(op)
+    switch(OP)
     {
         case 0: // str
         {
@@ -216,20 +337,23 @@ void Cpu::thumb_load_store_reg(uint16_t opcode)
 
 void Cpu::thumb_branch(uint16_t opcode)
 {
+    const uint32_t pc = regs[PC] - ARM_HALF_SIZE;
     uint32_t offset = (opcode & 0x3ff)*2;
     offset = sign_extend(offset,11);
     regs[PC] += offset+ARM_HALF_SIZE;
 
     cycle_tick(3); // 2s +1n 
+    check_idle_loop(pc);
 }
 
+template<const bool L>
 void Cpu::thumb_load_store_half(uint16_t opcode)
 {
     int nn = ((opcode >> 6) & 0x1f) * 2;
     int rb = (opcode >> 3) & 0x7;
     int rd = opcode & 0x7;
 
-    bool load = is_set(opcode,11);
+    constexpr bool load = L;
 
     if(load) // ldrh
     {
@@ -244,9 +368,10 @@ void Cpu::thumb_load_store_half(uint16_t opcode)
     } 
 }
 
+template<const bool POP>
 void Cpu::thumb_push_pop(uint16_t opcode)
 {
-    const bool pop = is_set(opcode,11);
+    constexpr bool pop = POP;
 
     const bool lr = is_set(opcode,8);
 
@@ -324,11 +449,11 @@ void Cpu::thumb_push_pop(uint16_t opcode)
 
 }
 
+template<const int OP>
 void Cpu::thumb_hi_reg_ops(uint16_t opcode)
 {
     int rd = opcode & 0x7;
     int rs = (opcode >> 3) & 0x7;
-    int op = (opcode >> 8) & 0x3;
 
     
 
@@ -363,7 +488,7 @@ void Cpu::thumb_hi_reg_ops(uint16_t opcode)
 
 
     // only cmp sets flags here!
-    switch(op)
+    switch(OP)
     {
         case 0b00: // add
         {
@@ -403,15 +528,15 @@ void Cpu::thumb_hi_reg_ops(uint16_t opcode)
     cycle_tick(cycles);
 }
 
+template<const int OP>
 void Cpu::thumb_alu(uint16_t opcode)
 {
-    int op = (opcode >> 6) & 0xf;
     int rs = (opcode >> 3) & 0x7;
     int rd = opcode & 0x7;
 
 
 
-    switch(op)
+    switch(OP)
     {
 
         case 0x0: // and
@@ -431,30 +556,30 @@ void Cpu::thumb_alu(uint16_t opcode)
 
         case 0x2: // lsl
         {
-            bool c = is_set(cpsr,C_BIT);
+            bool c = get_carry_flag();
             regs[rd] = lsl(regs[rd],regs[rs]&0xff,c);
             set_nz_flag(regs[rd]);
-            cpsr = c? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+            set_carry_flag(c);
             cycle_tick(2); // 1s + 1i
             break;
         }
 
         case 0x3: // lsr 
         {
-            bool c = is_set(cpsr,C_BIT);
+            bool c = get_carry_flag();
             regs[rd] = lsr(regs[rd],regs[rs]&0xff,c,false);
             set_nz_flag(regs[rd]);
-            cpsr = c? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+            set_carry_flag(c);
             cycle_tick(2); // 1s + 1i
             break;            
         }
 
         case 0x4: // asr
         {
-            bool c = is_set(cpsr,C_BIT);
+            bool c = get_carry_flag();
             regs[rd] = asr(regs[rd],regs[rs]&0xff,c,false);
             set_nz_flag(regs[rd]);
-            cpsr = c? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);   
+            set_carry_flag(c);   
             cycle_tick(2); // 1s + 1i
             break;         
         }
@@ -474,10 +599,10 @@ void Cpu::thumb_alu(uint16_t opcode)
         
         case 0x7: // ror
         {
-            bool c = is_set(cpsr,C_BIT);
+            bool c = get_carry_flag();
             regs[rd] = ror(regs[rd],regs[rs]&0xff,c,false);
             set_nz_flag(regs[rd]);
-            cpsr = c? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT);
+            set_carry_flag(c);
             cycle_tick(2); // 1s + 1i
             break;
         }
@@ -519,7 +644,7 @@ void Cpu::thumb_alu(uint16_t opcode)
         {
             regs[rd] *= regs[rs];
             set_nz_flag(regs[rd]);
-            cpsr = deset_bit(cpsr,C_BIT);
+            set_carry_flag(false);
             cycle_tick(1); // needs timing fix
             break;
         }
@@ -543,9 +668,7 @@ void Cpu::thumb_alu(uint16_t opcode)
 
         default:
         {
-            printf("thumb alu unimplemented: %08x\n",op);
-            print_regs();
-            exit(1); 
+            throw Emu_error(fmt::format("thumb alu unimplemented: {:08x}",OP));
         }
     }
 
@@ -554,10 +677,11 @@ void Cpu::thumb_alu(uint16_t opcode)
 }
 
 
+template<const bool L>
 void Cpu::thumb_multiple_load_store(uint16_t opcode)
 {
     int rb = (opcode >> 8) & 0x7;
-    bool load = is_set(opcode,11);
+    constexpr bool load = L;
 
     uint8_t reg_range = opcode & 0xff;
 
@@ -597,10 +721,9 @@ void Cpu::thumb_multiple_load_store(uint16_t opcode)
 }
 
 
+template<const int OP>
 void Cpu::thumb_ldst_imm(uint16_t opcode)
 {
-    int op = (opcode >> 11) & 3;
-
     int imm = (opcode >> 6) & 0x1f;
 
     int rb = (opcode >> 3) & 0x7;
@@ -608,7 +731,7 @@ void Cpu::thumb_ldst_imm(uint16_t opcode)
 
     // 1s + 1n + 1i for ldr
     // 2n for str
-    switch(op)
+    switch(OP)
     {
         case 0b00: // str
         {  
@@ -644,14 +767,14 @@ void Cpu::thumb_ldst_imm(uint16_t opcode)
 
 }
 
+template<const int OP>
 void Cpu::thumb_add_sub(uint16_t opcode)
 {
     int rd = opcode & 0x7;
     int rs = (opcode >> 3) & 0x7;
     int rn = (opcode >> 6) & 0x7; // can also be 3 bit imm
-    int op = (opcode >> 9) & 0x3;
 
-    switch(op)
+    switch(OP)
     {
         case 0b00: // add reg
         { 
@@ -679,9 +802,10 @@ void Cpu::thumb_add_sub(uint16_t opcode)
     cycle_tick(1);
 }
 
+template<const bool FIRST>
 void Cpu::thumb_long_bl(uint16_t opcode)
 {
-    bool first = !is_set(opcode,11);
+    constexpr bool first = FIRST;
 
     int32_t offset = opcode & 0x7ff; // offset is 11 bits
 
@@ -708,35 +832,36 @@ void Cpu::thumb_long_bl(uint16_t opcode)
 
 }
 
+template<const int TYPE>
 void Cpu::thumb_mov_reg_shift(uint16_t opcode)
 {
     int rd = opcode & 0x7;
     int rs = (opcode >> 3) & 0x7;
     int n = (opcode >> 6) & 0x1f;
 
-    Shift_type type = static_cast<Shift_type>((opcode >> 11) & 0x3);
+    constexpr Shift_type type = static_cast<Shift_type>(TYPE);
 
-    bool did_carry = is_set(cpsr,C_BIT);
+    bool did_carry = get_carry_flag();
 
     regs[rd] = barrel_shift(type,regs[rs],n,did_carry,true);
 
     set_nz_flag(regs[rd]);
 
 
-    cpsr = did_carry? set_bit(cpsr,C_BIT) : deset_bit(cpsr,C_BIT); 
+    set_carry_flag(did_carry); 
 
 
     // 1 s cycle
     cycle_tick(1);
 }
 
+template<const int OP>
 void Cpu::thumb_mcas_imm(uint16_t opcode)
 {
-    int op = (opcode >> 11) & 0x3;
     int rd = (opcode >> 8) & 0x7;
     uint8_t imm = opcode & 0xff;
 
-    switch(op)
+    switch(OP)
     {
         case 0b00: // mov
         {
@@ -769,17 +894,19 @@ void Cpu::thumb_mcas_imm(uint16_t opcode)
 }
 
 
+template<const int COND>
 void Cpu::thumb_cond_branch(uint16_t opcode)
 {
     int8_t offset = opcode & 0xff;
     uint32_t addr = (regs[PC]+2) + offset*2;
-    int cond = (opcode >> 8) & 0xf;
 
     // if branch taken 2s +1n cycles
-    if(cond_met(cond))
+    if(cond_met(COND))
     {
+        const uint32_t pc = regs[PC] - ARM_HALF_SIZE;
         regs[PC] = addr & ~1;
         cycle_tick(3);
+        check_idle_loop(pc);
     }
 
     // else 1s
@@ -0,0 +1,115 @@
+#include "headers/cpu.h"
+#include "headers/memory.h"
+#include "headers/scheduler.h"
+
+
+// prescaler of 1, 64, 256, 1024
+static constexpr int shift_table[4] = {0,6,8,10};
+
+static constexpr Interrupt interrupt_table[4] = {Interrupt::TIMER0,Interrupt::TIMER1,Interrupt::TIMER2,Interrupt::TIMER3};
+
+
+static Gba_event timer_event_type(int idx)
+{
+    return static_cast<Gba_event>(static_cast<int>(Gba_event::TIMER0) + idx);
+}
+
+
+uint16_t Cpu::read_timer(int idx) const
+{
+    const Timer &timer = timers[idx];
+
+    if(!timer.running)
+    {
+        return timer.counter;
+    }
+
+    // overflows are serviced as soon as they are due
+    // so this cant go past 0xffff
+    return timer.counter + ((scheduler->get_timestamp() - timer.start) >> timer.shift);
+}
+
+
+void Cpu::write_timer_control(int idx, uint8_t old_cnt)
+{
+    Timer &timer = timers[idx];
+    const uint8_t cnt = mem->io[IO_TM0CNT_H + idx * ARM_WORD_SIZE];
+
+    // stop the counter where it is under the old settings
+    timer.counter = read_timer(idx);
+
+    // turning on reloads it
+    if(is_set(cnt,7) && !is_set(old_cnt,7))
+    {
+        timer.counter = mem->handle_read<uint16_t>(mem->io,IO_TM0CNT_L + idx * ARM_WORD_SIZE);
+    }
+
+    // timer 0 has nothing to count up from
+    timer.start = scheduler->get_timestamp();
+    timer.shift = shift_table[cnt & 0x3];
+    timer.running = is_set(cnt,7) && (idx == 0 || !is_set(cnt,2));
+
+    schedule_timer(idx);
+}
+
+
+void Cpu::schedule_timer(int idx)
+{
+    const Timer &timer = timers[idx];
+
+    if(timer.running)
+    {
+        const uint64_t ticks = 0x10000 - timer.counter;
+        scheduler->insert(timer_event_type(idx),(ticks << timer.shift) - (scheduler->get_timestamp() - timer.start));
+    }
+
+    else
+    {
+        scheduler->remove(timer_event_type(idx));
+    }
+}
+
+
+void Cpu::timer_event(int idx)
+{
+    Timer &timer = timers[idx];
+
+    // the new period starts exactly when the overflow was due
+    // not when we got round to servicing it
+    timer.start += static_cast<uint64_t>(0x10000 - timer.counter) << timer.shift;
+    timer.counter = mem->handle_read<uint16_t>(mem->io,IO_TM0CNT_L + idx * ARM_WORD_SIZE);
+
+    const uint64_t ticks = 0x10000 - timer.counter;
+    scheduler->insert_relative(timer_event_type(idx),ticks << timer.shift);
+
+    timer_overflow(idx);
+}
+
+void Cpu::timer_overflow(int idx)
+{
+    const uint8_t cnt = mem->io[IO_TM0CNT_H + idx * ARM_WORD_SIZE];
+
+    if(is_set(cnt,6))
+    {
+        request_interrupt(interrupt_table[idx]);
+    }
+
+    if(idx == 3)
+    {
+        return;
+    }
+
+    // tick the next timer if its counting up
+    const uint8_t next_cnt = mem->io[IO_TM0CNT_H + (idx + 1) * ARM_WORD_SIZE];
+
+    if(is_set(next_cnt,7) && is_set(next_cnt,2))
+    {
+        Timer &next = timers[idx + 1];
+
+        if(++next.counter == 0)
+        {
+            next.counter = mem->handle_read<uint16_t>(mem->io,IO_TM0CNT_L + (idx + 1) * ARM_WORD_SIZE);
+            timer_overflow(idx + 1);
+        }
+    }
+}